@@ -2,6 +2,7 @@
 #include "../../include/interpreter.h"
 
 #include <cctype>
+#include <climits>
 
 namespace InterpreterBaseLib {
 
@@ -15,6 +16,14 @@ namespace InterpreterBaseLib {
       }
       return !s.empty();
     }
+
+    // same as isNumber + stoi for the string operand
+    bool isNumber(int64_t v) const {
+      return (v >= 0) && (v <= INT_MAX);
+    }
+    bool isInt(int64_t v) const {
+      return (v >= INT_MIN) && (v <= INT_MAX);
+    }
         
     ArithmeticOperations(Interpreter& ir)
     {
@@ -23,28 +32,28 @@ namespace InterpreterBaseLib {
         return std::to_string(stoi(leftOpd) * stoi(rightOpd));
       else
         return "0";
-      }, 0);
+      }, 0, true);
 
     ir.addOperator("/", [this](std::string& leftOpd, std::string& rightOpd) ->std::string {
       if (isNumber(leftOpd) && isNumber(rightOpd))
         return std::to_string(stoi(leftOpd) / stoi(rightOpd));
       else
         return "0";
-      }, 0);
+      }, 0, true);
 
     ir.addOperator("+", [this](std::string& leftOpd, std::string& rightOpd) ->std::string {
       if (isNumber(leftOpd) && isNumber(rightOpd))
         return std::to_string(stoi(leftOpd) + stoi(rightOpd));
       else
         return leftOpd + rightOpd;
-      }, 1);
+      }, 1, true);
 
     ir.addOperator("-", [this](std::string& leftOpd, std::string& rightOpd) ->std::string {
       if (isNumber(leftOpd) && isNumber(rightOpd))
         return std::to_string(stoi(leftOpd) - stoi(rightOpd));
       else
         return "0";
-      }, 1);
+      }, 1, true);
 
     ir.addOperator("+=", [this](std::string& leftOpd, std::string& rightOpd) ->std::string {
     if (isNumber(leftOpd) && isNumber(rightOpd)){
@@ -55,7 +64,7 @@ namespace InterpreterBaseLib {
       leftOpd += rightOpd;
       return leftOpd;
     }
-  }, 4);
+  }, 4, false, Interpreter::OperandMutability::LEFT);
 
   ir.addOperator("-=", [this](std::string& leftOpd, std::string& rightOpd) ->std::string {
     if (isNumber(leftOpd) && isNumber(rightOpd)){
@@ -66,7 +75,7 @@ namespace InterpreterBaseLib {
       leftOpd += rightOpd;
       return leftOpd;
     }
-  }, 4);
+  }, 4, false, Interpreter::OperandMutability::LEFT);
   ir.addOperator("++", [this](std::string& leftOpd, std::string& rightOpd) ->std::string {
     if (isNumber(leftOpd)){
       leftOpd = std::to_string(stoi(leftOpd) + 1);
@@ -92,7 +101,52 @@ namespace InterpreterBaseLib {
   ir.addOperator("=", [this](std::string& leftOpd, std::string& rightOpd) ->std::string {
     leftOpd = rightOpd;
     return leftOpd;
-  }, 100);
+  }, 100, false, Interpreter::OperandMutability::LEFT);
+
+  // fast path for numbers, falls back to the operators above otherwise
+  ir.addOperatorInt64("*", [this](int64_t& leftOpd, int64_t& rightOpd, int64_t& result) ->bool {
+    if (!isNumber(leftOpd) || !isNumber(rightOpd))
+      return false;
+    result = leftOpd * rightOpd;
+    return isInt(result);
+  });
+
+  ir.addOperatorInt64("/", [this](int64_t& leftOpd, int64_t& rightOpd, int64_t& result) ->bool {
+    if (!isNumber(leftOpd) || !isNumber(rightOpd) || (rightOpd == 0))
+      return false;
+    result = leftOpd / rightOpd;
+    return true;
+  });
+
+  ir.addOperatorInt64("+", [this](int64_t& leftOpd, int64_t& rightOpd, int64_t& result) ->bool {
+    if (!isNumber(leftOpd) || !isNumber(rightOpd))
+      return false;
+    result = leftOpd + rightOpd;
+    return isInt(result);
+  });
+
+  ir.addOperatorInt64("-", [this](int64_t& leftOpd, int64_t& rightOpd, int64_t& result) ->bool {
+    if (!isNumber(leftOpd) || !isNumber(rightOpd))
+      return false;
+    result = leftOpd - rightOpd;
+    return isInt(result);
+  });
+
+  ir.addOperatorInt64("+=", [this](int64_t& leftOpd, int64_t& rightOpd, int64_t& result) ->bool {
+    result = leftOpd + rightOpd;
+    if (!isNumber(leftOpd) || !isNumber(rightOpd) || !isInt(result))
+      return false;
+    leftOpd = result;
+    return true;
+  });
+
+  ir.addOperatorInt64("-=", [this](int64_t& leftOpd, int64_t& rightOpd, int64_t& result) ->bool {
+    result = leftOpd - rightOpd;
+    if (!isNumber(leftOpd) || !isNumber(rightOpd) || !isInt(result))
+      return false;
+    leftOpd = result;
+    return true;
+  });
 
   }
   };
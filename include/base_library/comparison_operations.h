@@ -2,6 +2,7 @@
 #include "../../include/interpreter.h"
 
 #include <cctype>
+#include <climits>
 
 namespace InterpreterBaseLib {
 
@@ -15,49 +16,85 @@ namespace InterpreterBaseLib {
       }
       return !s.empty();
     }
+
+    // same as isNumber + stoi for the string operand
+    bool isNumber(int64_t v) const {
+      return (v >= 0) && (v <= INT_MAX);
+    }
         
     ComparisonOperations(Interpreter& ir)
     {      
-      ir.addOperator("==", [](std::string& leftOpd, std::string& rightOpd) ->std::string {
+      ir.addOperatorView("==", [](const std::string& leftOpd, const std::string& rightOpd) ->std::string {
         return leftOpd == rightOpd ? "1" : "0";
-        }, 2);
+        }, 2, true);
 
-      ir.addOperator("!=", [](std::string& leftOpd, std::string& rightOpd) ->std::string {
+      ir.addOperatorView("!=", [](const std::string& leftOpd, const std::string& rightOpd) ->std::string {
         return leftOpd != rightOpd ? "1" : "0";
-        }, 2);
+        }, 2, true);
 
-      ir.addOperator(">", [this](std::string& leftOpd, std::string& rightOpd) ->std::string {
+      ir.addOperatorView(">", [this](const std::string& leftOpd, const std::string& rightOpd) ->std::string {
         if (isNumber(leftOpd) && isNumber(rightOpd))
           return stoi(leftOpd) > stoi(rightOpd) ? "1" : "0";
         else
           return leftOpd.size() > rightOpd.size() ? "1" : "0";
-        }, 2);
+        }, 2, true);
 
-      ir.addOperator("<", [this](std::string& leftOpd, std::string& rightOpd) ->std::string {
+      ir.addOperatorView("<", [this](const std::string& leftOpd, const std::string& rightOpd) ->std::string {
         if (isNumber(leftOpd) && isNumber(rightOpd))
           return stoi(leftOpd) < stoi(rightOpd) ? "1" : "0";
         else
           return leftOpd.size() < rightOpd.size() ? "1" : "0";
-        }, 2);
+        }, 2, true);
 
-      ir.addOperator(">=", [this](std::string& leftOpd, std::string& rightOpd) ->std::string {
+      ir.addOperatorView(">=", [this](const std::string& leftOpd, const std::string& rightOpd) ->std::string {
         if (isNumber(leftOpd) && isNumber(rightOpd))
           return stoi(leftOpd) >= stoi(rightOpd) ? "1" : "0";
         else
           return leftOpd.size() >= rightOpd.size() ? "1" : "0";
-        }, 2);
+        }, 2, true);
 
-      ir.addOperator("<=", [this](std::string& leftOpd, std::string& rightOpd) ->std::string {
+      ir.addOperatorView("<=", [this](const std::string& leftOpd, const std::string& rightOpd) ->std::string {
         if (isNumber(leftOpd) && isNumber(rightOpd))
           return stoi(leftOpd) <= stoi(rightOpd) ? "1" : "0";
         else
           return leftOpd.size() <= rightOpd.size() ? "1" : "0";
-        }, 2);
+        }, 2, true);
 
       ir.addOperator("=", [](std::string& leftOpd, std::string& rightOpd) ->std::string {
         leftOpd = rightOpd;
         return leftOpd;
-        }, 100);
+        }, 100, false, Interpreter::OperandMutability::LEFT);
+
+      // fast path for numbers, falls back to the operators above otherwise
+      ir.addOperatorInt64("==", [](int64_t& leftOpd, int64_t& rightOpd, int64_t& result) ->bool {
+        result = leftOpd == rightOpd ? 1 : 0;
+        return true;
+        });
+
+      ir.addOperatorInt64("!=", [](int64_t& leftOpd, int64_t& rightOpd, int64_t& result) ->bool {
+        result = leftOpd != rightOpd ? 1 : 0;
+        return true;
+        });
+
+      ir.addOperatorInt64(">", [this](int64_t& leftOpd, int64_t& rightOpd, int64_t& result) ->bool {
+        result = leftOpd > rightOpd ? 1 : 0;
+        return isNumber(leftOpd) && isNumber(rightOpd);
+        });
+
+      ir.addOperatorInt64("<", [this](int64_t& leftOpd, int64_t& rightOpd, int64_t& result) ->bool {
+        result = leftOpd < rightOpd ? 1 : 0;
+        return isNumber(leftOpd) && isNumber(rightOpd);
+        });
+
+      ir.addOperatorInt64(">=", [this](int64_t& leftOpd, int64_t& rightOpd, int64_t& result) ->bool {
+        result = leftOpd >= rightOpd ? 1 : 0;
+        return isNumber(leftOpd) && isNumber(rightOpd);
+        });
+
+      ir.addOperatorInt64("<=", [this](int64_t& leftOpd, int64_t& rightOpd, int64_t& result) ->bool {
+        result = leftOpd <= rightOpd ? 1 : 0;
+        return isNumber(leftOpd) && isNumber(rightOpd);
+        });
     }
   };
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <cctype>
 #include <sstream>
+#include <unordered_map>
 
 namespace InterpreterBaseLib {
 
@@ -36,8 +37,10 @@ namespace InterpreterBaseLib {
                         
         if (rightOpd == "Vector") {
           m_vectorContr[leftOpd] = std::vector<std::string>();
+          m_mapContr.erase(leftOpd);
+          ++m_contrEpoch;
 
-          auto entityRight = m_intr.getEntityByIndex(m_intr.currentEntity().beginIndex + 1);
+          auto entityRight = m_intr.getEntityByIndex(m_intr.currentIndex() + 1);
 
           std::string& initBody = entityRight.value;
 
@@ -48,8 +51,6 @@ namespace InterpreterBaseLib {
               cp = 0;
             int bordCnt = 0;
 
-            Interpreter intrCopy = m_intr;
-
             while (cp < ssz) {
               if (initBody[cp] == '(') ++bordCnt;
               if (initBody[cp] == ')') --bordCnt;
@@ -58,9 +59,9 @@ namespace InterpreterBaseLib {
                 if (cp == ssz - 1) ++cp;
 
                 const std::string arg = initBody.substr(cpos, cp - cpos);
-                std::string err;
-                if (intrCopy.parseScript(arg, err))
-                  m_vectorContr[leftOpd].push_back(intrCopy.runScript());
+                std::string err, value;
+                if (m_intr.evalScript(arg, value, err))
+                  m_vectorContr[leftOpd].push_back(value);
 
                 cpos = cp + 1;
               }
@@ -70,8 +71,10 @@ namespace InterpreterBaseLib {
         }
         else if (rightOpd == "Map") {
           m_mapContr[leftOpd] = std::map<std::string, std::string>();
+          m_vectorContr.erase(leftOpd);
+          ++m_contrEpoch;
 
-          auto entityRight = m_intr.getEntityByIndex(m_intr.currentEntity().beginIndex + 1);
+          auto entityRight = m_intr.getEntityByIndex(m_intr.currentIndex() + 1);
 
           std::string& initBody = entityRight.value;
 
@@ -82,8 +85,6 @@ namespace InterpreterBaseLib {
               cp = 0;
             int bordCnt = 0;
 
-            Interpreter intrCopy = m_intr;
-
             while (cp < ssz) {
               if (initBody[cp] == '(') ++bordCnt;
               if (initBody[cp] == ')') --bordCnt;
@@ -92,9 +93,9 @@ namespace InterpreterBaseLib {
                 if (cp == ssz - 1) ++cp;
 
                 auto args = split(initBody.substr(cpos, cp - cpos), ':');
-                std::string err;
-                if ((args.size() > 1) && intrCopy.parseScript(args[1], err))
-                  m_mapContr[leftOpd][args[0]] = intrCopy.runScript();
+                std::string err, value;
+                if ((args.size() > 1) && m_intr.evalScript(args[1], value, err))
+                  m_mapContr[leftOpd][args[0]] = value;
                 else if (!args.empty())
                   m_mapContr[leftOpd][args[0]] = "";
 
@@ -108,69 +109,58 @@ namespace InterpreterBaseLib {
           return currOperator(leftOpd, rightOpd);
         }
         return leftOpd;
-      }, 100);
+      }, 100, false, Interpreter::OperandMutability::LEFT);
 
       currOperator = ir.getUserOperator(".");
-      ir.addOperator(".", [this, currOperator](std::string& leftOpd, std::string& rightOpd) ->std::string {
+      ir.addOperatorView(".", [this, currOperator](const std::string& leftOpd, const std::string& rightOpd) ->std::string {
         if (m_vectorContr.count(leftOpd) || m_mapContr.count(leftOpd)) {
           return rightOpd;
         }
         else if (currOperator) {
-          return currOperator(leftOpd, rightOpd);
+          std::string lOpd = leftOpd, rOpd = rightOpd;
+          return currOperator(lOpd, rOpd);
         }
         return leftOpd + '.' + rightOpd;
       }, 0);
 
       currOperator = ir.getUserOperator("[");
-      ir.addOperator("[", [this, currOperator](std::string& leftOpd, std::string& rightOpd) ->std::string {
-        if (m_vectorContr.count(leftOpd) || m_mapContr.count(leftOpd)) {
-          auto value = m_intr.getEntityByIndex(m_intr.currentEntity().beginIndex - 1).value;
-          Interpreter intrCopy = m_intr;
-          std::string err;
-          if (!value.empty() && intrCopy.parseScript(value, err)){
-            auto key = intrCopy.runScript();
-            if (m_vectorContr.count(leftOpd)){
-              auto ix = isNumber(key) ? stoi(key) : -1;
-              if (0 <= ix && ix < m_vectorContr[leftOpd].size()){
-                return m_vectorContr[leftOpd][ix];
-              }
-            }else if (m_mapContr[leftOpd].count(key)){
-              return m_mapContr[leftOpd][key];
-            }
-          } else if (value.empty()){
-            err = "error value.empty";
-          }
-          return err;
+      ir.addOperatorView("[", [this, currOperator](const std::string& leftOpd, const std::string& rightOpd) ->std::string {
+        // the index is calculated by the interpreter
+        if (auto vec = vectorContr(leftOpd)) {
+          return !rightOpd.empty() ? vectorAt(*vec, rightOpd) : "error value.empty";
+        }
+        else if (auto mp = mapContr(leftOpd)) {
+          return !rightOpd.empty() ? mapAt(*mp, rightOpd) : "error value.empty";
         }
         else if (currOperator) {
-          return currOperator(leftOpd, rightOpd);
+          std::string lOpd = leftOpd, rOpd = rightOpd;
+          return currOperator(lOpd, rOpd);
         }
         return "0";
       }, 0);
 
       currOperator = ir.getUserOperator(":");
       ir.addOperator(":", [this, currOperator](std::string& leftOpd, std::string& rightOpd) ->std::string {
-        if (m_vectorContr.count(rightOpd)) {
+        // the loop "while($v : container)" takes the iterator below, the operator is for other expressions
+        if (auto vec = vectorContr(rightOpd)) {
           
-          int itPos = m_intr.currentEntity().value.empty() ? 0 : stoi(m_intr.currentEntity().value);
+          const std::string itVal = m_intr.currentEntity().value;
+          int itPos = itVal.empty() ? 0 : stoi(itVal);
 
-          if (itPos < (int)m_vectorContr[rightOpd].size()) {
-            leftOpd = m_vectorContr[rightOpd][itPos];
+          if (itPos < (int)vec->size()) {
+            leftOpd = (*vec)[itPos];
             return std::to_string(++itPos);
           }
           else return "0";
         }
-        else if (m_mapContr.count(rightOpd)) {
+        else if (auto mp = mapContr(rightOpd)) {
 
-          int itPos = m_intr.currentEntity().value.empty() ? 0 : stoi(m_intr.currentEntity().value);
+          const std::string itVal = m_intr.currentEntity().value;
+          int itPos = itVal.empty() ? 0 : stoi(itVal);
 
-          if (itPos < (int)m_mapContr[rightOpd].size()) {
-            int cpos = 0;
-            for (auto& v : m_mapContr[rightOpd]) {
-              leftOpd = v.first + '\t' + v.second;
-              ++cpos;
-              if (cpos > itPos) break;
-            }       
+          if (itPos < (int)mp->size()) {
+            auto it = std::next(mp->begin(), itPos);
+            leftOpd = it->first + '\t' + it->second;
             return std::to_string(++itPos);
           }
           else return "0";
@@ -181,104 +171,105 @@ namespace InterpreterBaseLib {
         return leftOpd + ':' + rightOpd;
         }, 0);
 
+      ir.addIterable([this](const std::string& container) ->Interpreter::UserIterator {
+        if (vectorContr(container))
+          return vectorIterator(container);
+        else if (mapContr(container))
+          return mapIterator(container);
+        return nullptr;
+      });
+
       auto currFunction = ir.getUserFunction("push_back");
       ir.addFunction("push_back", [this, currFunction](const std::vector<std::string>& args) ->std::string {
 
-        std::string vecName = getContrNameByFunction(m_intr.currentEntity().beginIndex);
-
-        std::string ok = "0";
-        if (m_vectorContr.count(vecName)) {
-          for (auto& a : args)
-            m_vectorContr[vecName].push_back(a);
-          ok = "1";
+        auto vec = vectorByFunction();
+        if (vec) {
+          vec->insert(vec->end(), args.begin(), args.end());
+          return "1";
         }
         else if (currFunction) {
           return currFunction(args);
         }
-        return ok;
+        return "0";
       });
 
       currFunction = ir.getUserFunction("pop_back");
       ir.addFunction("pop_back", [this, currFunction](const std::vector<std::string>& args) ->std::string {
 
-        std::string vecName = getContrNameByFunction(m_intr.currentEntity().beginIndex);
-
-        std::string ok = "0";
-        if (m_vectorContr.count(vecName)) {
-          if (!m_vectorContr[vecName].empty()) {
-            m_vectorContr[vecName].pop_back();
-            ok = "1";
+        auto vec = vectorByFunction();
+        if (vec) {
+          if (!vec->empty()) {
+            vec->pop_back();
+            return "1";
           }
         }
         else if (currFunction) {
           return currFunction(args);
         }
-        return ok;
+        return "0";
         });
 
       currFunction = ir.getUserFunction("insert");
       ir.addFunction("insert", [this, currFunction](const std::vector<std::string>& args) ->std::string {
 
-        std::string contrName = getContrNameByFunction(m_intr.currentEntity().beginIndex);
+        std::string contrName = getContrNameByFunction(m_intr.currentIndex());
 
-        std::string ok = "0";
-        if (m_vectorContr.count(contrName)) {
+        if (auto vec = vectorContr(contrName)) {
           if ((args.size() > 1) && isNumber(args[0])) {
             size_t inx = size_t(stoi(args[0]));
-            if (m_vectorContr[contrName].size() > inx) {
-              m_vectorContr[contrName].insert(m_vectorContr[contrName].begin() + inx, args[1]);
-              ok = "1";
+            if (vec->size() > inx) {
+              vec->insert(vec->begin() + inx, args[1]);
+              return "1";
             }
           }
         }
-        else if (m_mapContr.count(contrName)) {
+        else if (auto mp = mapContr(contrName)) {
           if (args.size() > 1) {
-            m_mapContr[contrName][args[0]] = args[1];
-            ok = "1";
+            (*mp)[args[0]] = args[1];
+            return "1";
           }
         }
         else if (currFunction) {
           return currFunction(args);
         }
-        return ok;
+        return "0";
         });
 
       currFunction = ir.getUserFunction("erase");
       ir.addFunction("erase", [this, currFunction](const std::vector<std::string>& args) ->std::string {
 
-        std::string contrName = getContrNameByFunction(m_intr.currentEntity().beginIndex);
+        std::string contrName = getContrNameByFunction(m_intr.currentIndex());
 
-        std::string ok = "0";
-        if (m_vectorContr.count(contrName)) {
+        if (auto vec = vectorContr(contrName)) {
           if (!args.empty() && isNumber(args[0])) {
             size_t inx = size_t(stoi(args[0]));
-            if (m_vectorContr[contrName].size() > inx) {
-              m_vectorContr[contrName].erase(m_vectorContr[contrName].begin() + inx);
-              ok = "1";
+            if (vec->size() > inx) {
+              vec->erase(vec->begin() + inx);
+              return "1";
             }
           }
         }
-        else if (m_mapContr.count(contrName)) {
-          if (!args.empty() && m_mapContr[contrName].count(args[0])) {
-            m_mapContr[contrName].erase(args[0]);
-            ok = "1";
+        else if (auto mp = mapContr(contrName)) {
+          if (!args.empty() && mp->erase(args[0])) {
+            ++m_contrEpoch;
+            return "1";
           }
         }
         else if (currFunction) {
           return currFunction(args);
         }
-        return ok;
+        return "0";
         });
 
       currFunction = ir.getUserFunction("size");
       ir.addFunction("size", [this, currFunction](const std::vector<std::string>& args) ->std::string {
 
-        std::string contrName = getContrNameByFunction(m_intr.currentEntity().beginIndex);
+        std::string contrName = getContrNameByFunction(m_intr.currentIndex());
 
-        if (m_vectorContr.count(contrName))
-          return std::to_string(m_vectorContr[contrName].size());
-        else if (m_mapContr.count(contrName))
-          return std::to_string(m_mapContr[contrName].size());
+        if (auto vec = vectorContr(contrName))
+          return std::to_string(vec->size());
+        else if (auto mp = mapContr(contrName))
+          return std::to_string(mp->size());
         else if (currFunction) {
           return currFunction(args);
         }
@@ -288,12 +279,12 @@ namespace InterpreterBaseLib {
       currFunction = ir.getUserFunction("empty");
       ir.addFunction("empty", [this, currFunction](const std::vector<std::string>& args) ->std::string {
 
-        std::string contrName = getContrNameByFunction(m_intr.currentEntity().beginIndex);
+        std::string contrName = getContrNameByFunction(m_intr.currentIndex());
 
-        if (m_vectorContr.count(contrName))
-          return m_vectorContr[contrName].empty() ? "1" : "0";
-        else if (m_mapContr.count(contrName))
-          return  m_mapContr[contrName].empty() ? "1" : "0";
+        if (auto vec = vectorContr(contrName))
+          return vec->empty() ? "1" : "0";
+        else if (auto mp = mapContr(contrName))
+          return mp->empty() ? "1" : "0";
         else if (currFunction) {
           return currFunction(args);
         }
@@ -303,87 +294,143 @@ namespace InterpreterBaseLib {
       currFunction = ir.getUserFunction("clear");
       ir.addFunction("clear", [this, currFunction](const std::vector<std::string>& args) ->std::string {
 
-        std::string contrName = getContrNameByFunction(m_intr.currentEntity().beginIndex);
+        std::string contrName = getContrNameByFunction(m_intr.currentIndex());
 
-        std::string ok = "0";
-        if (m_vectorContr.count(contrName)) {
-          m_vectorContr[contrName].clear();
-          ok = "1";
+        if (auto vec = vectorContr(contrName)) {
+          vec->clear();
+          return "1";
         }
-        else if (m_mapContr.count(contrName)) {
-          m_mapContr[contrName].clear();
-          ok = "1";
+        else if (auto mp = mapContr(contrName)) {
+          mp->clear();
+          ++m_contrEpoch;
+          return "1";
         }
         else if (currFunction) {
           return currFunction(args);
         }
-        return ok;
+        return "0";
         });
 
       currFunction = ir.getUserFunction("at");
       ir.addFunction("at", [this, currFunction](const std::vector<std::string>& args) ->std::string {
 
-        std::string contrName = getContrNameByFunction(m_intr.currentEntity().beginIndex);
+        std::string contrName = getContrNameByFunction(m_intr.currentIndex());
 
-        std::string out;
-        if (m_vectorContr.count(contrName)) {
-          if (!args.empty() && isNumber(args[0])) {
-            size_t inx = size_t(stoi(args[0]));
-            if (m_vectorContr[contrName].size() > inx)
-              out = m_vectorContr[contrName][inx];
-          }
+        if (auto vec = vectorContr(contrName)) {
+          if (!args.empty())
+            return vectorAt(*vec, args[0]);
         }
-        else if (m_mapContr.count(contrName)) {
-          if (!args.empty() && m_mapContr[contrName].count(args[0]))
-            out = m_mapContr[contrName][args[0]];
+        else if (auto mp = mapContr(contrName)) {
+          if (!args.empty())
+            return mapAt(*mp, args[0]);
         }
         else if (currFunction) {
           return currFunction(args);
         }
-        return out;
+        return "";
       });
 
       currFunction = ir.getUserFunction("set");
       ir.addFunction("set", [this, currFunction](const std::vector<std::string>& args) ->std::string {
 
-        std::string contrName = getContrNameByFunction(m_intr.currentEntity().beginIndex);
+        std::string contrName = getContrNameByFunction(m_intr.currentIndex());
 
-        std::string ok = "0";
-        if (m_vectorContr.count(contrName)) {
+        if (auto vec = vectorContr(contrName)) {
           if ((args.size() > 1) && isNumber(args[0])) {
             size_t inx = size_t(stoi(args[0]));
-            if (m_vectorContr[contrName].size() > inx) {
-              m_vectorContr[contrName][inx] = args[1];
-              ok = "1";
+            if (vec->size() > inx) {
+              (*vec)[inx] = args[1];
+              return "1";
             }
           }
         }
-        else if (m_mapContr.count(contrName)) {
-          if ((args.size() > 1) && m_mapContr[contrName].count(args[0])) {
-            m_mapContr[contrName][args[0]] = args[1];
-            ok = "1";
+        else if (auto mp = mapContr(contrName)) {
+          auto it = (args.size() > 1) ? mp->find(args[0]) : mp->end();
+          if (it != mp->end()) {
+            it->second = args[1];
+            return "1";
           }
         }
         else if (currFunction) {
           return currFunction(args);
         }
-        return ok;
+        return "0";
       });
     }
 
-    std::string getContrNameByFunction(size_t funcBeginIndex){
-            
-      std::string out;
-      if ((funcBeginIndex - 1 >= 0) && (m_intr.getEntityByIndex(funcBeginIndex - 1).name == ".")){
-        if (funcBeginIndex - 2 >= 0)
-          out = m_intr.getEntityByIndex(funcBeginIndex - 2).name;
+    std::string getContrNameByFunction(size_t funcIndex){
+      // the function is called as "name.func(...)", the names are taken without copies of entities
+      if ((funcIndex >= 2) && (m_intr.getNameByIndex(funcIndex - 1) == "."))
+        return m_intr.getNameByIndex(funcIndex - 2);
+      return std::string();
+    }
+
+    std::vector<std::string>* vectorContr(const std::string& name) {
+      auto it = m_vectorContr.find(name);
+      return (it != m_vectorContr.end()) ? &it->second : nullptr;
+    }
+
+    std::map<std::string, std::string>* mapContr(const std::string& name) {
+      auto it = m_mapContr.find(name);
+      return (it != m_mapContr.end()) ? &it->second : nullptr;
+    }
+
+    std::vector<std::string>* vectorByFunction() {
+      return vectorContr(getContrNameByFunction(m_intr.currentIndex()));
+    }
+
+    std::string vectorAt(const std::vector<std::string>& vec, const std::string& index) const {
+      if (isNumber(index)) {
+        size_t inx = size_t(stoi(index));
+        if (vec.size() > inx)
+          return vec[inx];
       }
-      return out;
+      return "";
+    }
+
+    // by index, the vector can be changed in the loop
+    Interpreter::UserIterator vectorIterator(const std::string& name) {
+      return [this, name, vec = vectorContr(name), epoch = m_contrEpoch, inx = size_t(0)](std::string& outValue) mutable {
+        if (epoch != m_contrEpoch) {
+          epoch = m_contrEpoch;
+          vec = vectorContr(name);
+        }
+        if (!vec || (inx >= vec->size()))
+          return false;
+        outValue = (*vec)[inx++];
+        return true;
+      };
+    }
+
+    // by iterator, it is found again by the last key if elements or containers were erased in the loop
+    Interpreter::UserIterator mapIterator(const std::string& name) {
+      auto mp = mapContr(name);
+      return [this, name, mp, it = mp->begin(), key = std::string(), epoch = m_contrEpoch, isBegin = true](std::string& outValue) mutable {
+        if (epoch != m_contrEpoch) {
+          epoch = m_contrEpoch;
+          mp = mapContr(name);
+          if (mp)
+            it = isBegin ? mp->begin() : mp->upper_bound(key);
+        }
+        if (!mp || (it == mp->end()))
+          return false;
+        key = it->first;
+        outValue.assign(it->first).append(1, '\t').append(it->second);
+        isBegin = false;
+        ++it;
+        return true;
+      };
+    }
+
+    std::string mapAt(const std::map<std::string, std::string>& mp, const std::string& key) const {
+      auto it = mp.find(key);
+      return (it != mp.end()) ? it->second : "";
     }
 
   protected:
     Interpreter& m_intr;
-    std::map<std::string, std::vector<std::string>> m_vectorContr;
-    std::map<std::string, std::map<std::string, std::string>> m_mapContr;
+    std::unordered_map<std::string, std::vector<std::string>> m_vectorContr;
+    std::unordered_map<std::string, std::map<std::string, std::string>> m_mapContr;
+    size_t m_contrEpoch = 0;  // is changed when containers or elements of map are erased
   };
-}
\ No newline at end of file
+}
@@ -1,43 +1,106 @@
 
 #include "../../include/interpreter.h"
 
+#include <algorithm>
 #include <cctype>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <set>
+#include <memory>
+#include <unordered_map>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifndef S_ISDIR  // not defined by msvc
+#define S_ISDIR(m) (((m) & S_IFMT) == S_IFDIR)
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 
 namespace InterpreterBaseLib {
 
   class Filesystem {
   public:
-        
+
+    // content of file mapped to memory (is read on Windows)
+    class MappedFile {
+    public:
+      explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        std::ifstream fs(path, std::ios_base::binary);
+        if (fs.good()) {
+          m_buff.assign(std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>());
+          m_data = m_buff.data();
+          m_size = m_buff.size();
+          m_good = true;
+        }
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+          return;
+        struct stat info;
+        if ((fstat(fd, &info) == 0) && S_ISREG(info.st_mode)) {
+          m_size = size_t(info.st_size);
+          void* addr = (m_size > 0) ? mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+          if (addr != MAP_FAILED) {
+            m_data = static_cast<const char*>(addr);
+            if (addr) madvise(addr, m_size, MADV_SEQUENTIAL);
+            m_good = true;
+          }
+          else m_size = 0;
+        }
+        close(fd);
+#endif
+      }
+      ~MappedFile() {
+#ifndef _WIN32
+        if (m_data) munmap(const_cast<char*>(m_data), m_size);
+#endif
+      }
+      MappedFile(const MappedFile&) = delete;
+      MappedFile& operator=(const MappedFile&) = delete;
+
+      bool good() const { return m_good; }
+      const char* data() const { return m_data; }
+      size_t size() const { return m_size; }
+    private:
+      const char* m_data = nullptr;
+      size_t m_size = 0;
+      bool m_good = false;
+#ifdef _WIN32
+      std::string m_buff;
+#endif
+    };
+
     Filesystem(Interpreter& ir):
       m_intr(ir)
     {      
       auto currOperator = ir.getUserOperator("=");
       ir.addOperator("=", [this, currOperator](std::string& leftOpd, std::string& rightOpd) ->std::string {
                         
-        if (rightOpd == "File") {          
-          auto initBody = m_intr.getEntityByIndex(m_intr.currentEntity().beginIndex + 1).value;
+        if (rightOpd == "File") {
+          auto itFile = m_fileHandler.find(leftOpd);
+          if (itFile != m_fileHandler.end())
+            m_writer.erase(itFile->second);  // the writer is closed on reassign
+          auto initBody = m_intr.getEntityByIndex(m_intr.currentIndex() + 1).value;
           if (!initBody.empty()) {
-            Interpreter intrCopy = m_intr;
-            std::string err;
-            if (intrCopy.parseScript(initBody, err))
-              m_fileHandler[leftOpd] = intrCopy.runScript();
+            std::string err, path;
+            if (m_intr.evalScript(initBody, path, err))
+              m_fileHandler[leftOpd] = path;
           }
           else
             m_fileHandler[leftOpd];
         }
         else if (rightOpd == "Dir") {
-          auto initBody = m_intr.getEntityByIndex(m_intr.currentEntity().beginIndex + 1).value;
+          auto initBody = m_intr.getEntityByIndex(m_intr.currentIndex() + 1).value;
           if (!initBody.empty()) {
-            Interpreter intrCopy = m_intr;
-            std::string err;
-            if (intrCopy.parseScript(initBody, err))
-              m_dirHandler[leftOpd] = intrCopy.runScript();
+            std::string err, path;
+            if (m_intr.evalScript(initBody, path, err))
+              m_dirHandler[leftOpd] = path;
           }
           else
             m_dirHandler[leftOpd];
@@ -46,15 +109,16 @@ namespace InterpreterBaseLib {
           return currOperator(leftOpd, rightOpd);
         }
         return leftOpd;
-      }, 100);
+      }, 100, false, Interpreter::OperandMutability::LEFT);
 
       currOperator = ir.getUserOperator(".");
-      ir.addOperator(".", [this, currOperator](std::string& leftOpd, std::string& rightOpd) ->std::string {
+      ir.addOperatorView(".", [this, currOperator](const std::string& leftOpd, const std::string& rightOpd) ->std::string {
         if (m_fileHandler.count(leftOpd) || m_dirHandler.count(leftOpd)) {
           return rightOpd;
         }
         else if (currOperator) {
-          return currOperator(leftOpd, rightOpd);
+          std::string lOpd = leftOpd, rOpd = rightOpd;
+          return currOperator(lOpd, rOpd);
         }
         return leftOpd + '.' + rightOpd;
       }, 0);
@@ -62,14 +126,20 @@ namespace InterpreterBaseLib {
       auto currFunction = ir.getUserFunction("read");
       ir.addFunction("read", [this, currFunction](const std::vector<std::string>& args) ->std::string {
 
-        std::string contrName = getContrNameByFunction(m_intr.currentEntity().beginIndex);
+        std::string contrName = getContrNameByFunction(m_intr.currentIndex());
 
-        if (m_fileHandler.count(contrName)) {          
-          std::ifstream fs(m_fileHandler[contrName]);
+        auto itFile = m_fileHandler.find(contrName);
+        if (itFile != m_fileHandler.end()) {
+          flushWriter(itFile->second);
+          std::ifstream fs(itFile->second);
           if (fs.good()) {
-            std::stringstream strStream;
-            strStream << fs.rdbuf();
-            return strStream.str();
+            // one read in the result, the size is known
+            fs.seekg(0, std::ios_base::end);
+            std::string data(size_t(std::max(std::streamoff(fs.tellg()), std::streamoff(0))), '\0');
+            fs.seekg(0, std::ios_base::beg);
+            fs.read(&data[0], data.size());
+            data.resize(size_t(fs.gcount()));
+            return data;
           }
           else {
             return "0";
@@ -84,10 +154,15 @@ namespace InterpreterBaseLib {
       currFunction = ir.getUserFunction("write");
       ir.addFunction("write", [this, currFunction](const std::vector<std::string>& args) ->std::string {
 
-        std::string contrName = getContrNameByFunction(m_intr.currentEntity().beginIndex);
+        std::string contrName = getContrNameByFunction(m_intr.currentIndex());
 
-        if (m_fileHandler.count(contrName)) {
-          std::ofstream fs(m_fileHandler[contrName]);
+        auto itFile = m_fileHandler.find(contrName);
+        if (itFile != m_fileHandler.end()) {
+          std::ofstream& fs = m_writer[itFile->second];
+          if (fs.is_open())
+            fs.close();
+          fs.clear();
+          fs.open(itFile->second);
           if (fs.good() && !args.empty()) {
             fs << args[0];
             return "1";
@@ -104,10 +179,15 @@ namespace InterpreterBaseLib {
       currFunction = ir.getUserFunction("append");
       ir.addFunction("append", [this, currFunction](const std::vector<std::string>& args) ->std::string {
 
-        std::string contrName = getContrNameByFunction(m_intr.currentEntity().beginIndex);
+        std::string contrName = getContrNameByFunction(m_intr.currentIndex());
 
-        if (m_fileHandler.count(contrName)) {
-          std::ofstream fs(m_fileHandler[contrName], std::ios_base::app);
+        auto itFile = m_fileHandler.find(contrName);
+        if (itFile != m_fileHandler.end()) {
+          std::ofstream& fs = m_writer[itFile->second];
+          if (!fs.is_open()) {
+            fs.clear();
+            fs.open(itFile->second, std::ios_base::app);
+          }
           if (fs.good() && !args.empty()) {
             fs << args[0];
             return "1";
@@ -124,9 +204,10 @@ namespace InterpreterBaseLib {
       currFunction = ir.getUserFunction("exist");
       ir.addFunction("exist", [this, currFunction](const std::vector<std::string>& args) ->std::string {
 
-        std::string contrName = getContrNameByFunction(m_intr.currentEntity().beginIndex);
+        std::string contrName = getContrNameByFunction(m_intr.currentIndex());
 
         if (m_fileHandler.count(contrName)) {
+          flushWriter(m_fileHandler[contrName]);
           std::ifstream fs(m_fileHandler[contrName]);
           return fs.good() ? "1" : "0";
         }
@@ -134,7 +215,7 @@ namespace InterpreterBaseLib {
           struct stat info;
           if (stat(m_dirHandler[contrName].c_str(), &info) != 0) // cannot access
             return "0";
-          else if (info.st_mode & S_IFDIR)
+          else if (S_ISDIR(info.st_mode))
             return "1";
           else
             return "0";
@@ -148,9 +229,10 @@ namespace InterpreterBaseLib {
       currFunction = ir.getUserFunction("remove");
       ir.addFunction("remove", [this, currFunction](const std::vector<std::string>& args) ->std::string {
 
-        std::string contrName = getContrNameByFunction(m_intr.currentEntity().beginIndex);
+        std::string contrName = getContrNameByFunction(m_intr.currentIndex());
 
         if (m_fileHandler.count(contrName) || m_dirHandler.count(contrName)) {
+          m_writer.erase(m_fileHandler[contrName]);
           return remove(m_fileHandler[contrName].c_str()) == 0 ? "1" : "0";
         }
         else if (currFunction) {
@@ -158,21 +240,119 @@ namespace InterpreterBaseLib {
         }
         return "0";
       });
+
+      currFunction = ir.getUserFunction("close");
+      ir.addFunction("close", [this, currFunction](const std::vector<std::string>& args) ->std::string {
+
+        std::string contrName = getContrNameByFunction(m_intr.currentIndex());
+
+        auto itFile = m_fileHandler.find(contrName);
+        if (itFile != m_fileHandler.end()) {
+          return m_writer.erase(itFile->second) ? "1" : "0";
+        }
+        else if (currFunction) {
+          return currFunction(args);
+        }
+        return "0";
+      });
+
+      // sequences of file for loop "while($line : f.lines())"
+      currFunction = ir.getUserFunction("lines");
+      ir.addFunction("lines", [this, currFunction](const std::vector<std::string>& args) ->std::string {
+
+        std::string contrName = getContrNameByFunction(m_intr.currentIndex());
+
+        if (m_fileHandler.count(contrName)) {
+          std::string seq = contrName + ".lines()";
+          m_sequence[seq] = Sequence{ contrName, 0 };
+          return seq;
+        }
+        else if (currFunction) {
+          return currFunction(args);
+        }
+        return "";
+      });
+
+      currFunction = ir.getUserFunction("chunks");
+      ir.addFunction("chunks", [this, currFunction](const std::vector<std::string>& args) ->std::string {
+
+        std::string contrName = getContrNameByFunction(m_intr.currentIndex());
+
+        if (m_fileHandler.count(contrName)) {
+          size_t chunk = (!args.empty() && isNumber(args[0])) ? size_t(stoull(args[0])) : 0;
+          if (chunk == 0)
+            return "0";
+          std::string seq = contrName + ".chunks(" + std::to_string(chunk) + ")";
+          m_sequence[seq] = Sequence{ contrName, chunk };
+          return seq;
+        }
+        else if (currFunction) {
+          return currFunction(args);
+        }
+        return "";
+      });
+
+      ir.addIterable([this](const std::string& container) ->Interpreter::UserIterator {
+        auto itSeq = m_sequence.find(container);
+        if (itSeq == m_sequence.end())
+          return nullptr;
+        auto itFile = m_fileHandler.find(itSeq->second.file);
+        if (itFile == m_fileHandler.end())
+          return nullptr;
+        flushWriter(itFile->second);
+        return sequenceIterator(std::make_shared<MappedFile>(itFile->second), itSeq->second.chunk);
+      });
     }
 
-    std::string getContrNameByFunction(size_t funcBeginIndex){
-            
-      std::string out;
-      if ((funcBeginIndex - 1 >= 0) && (m_intr.getEntityByIndex(funcBeginIndex - 1).name == ".")){
-        if (funcBeginIndex - 2 >= 0)
-          out = m_intr.getEntityByIndex(funcBeginIndex - 2).name;
+    bool isNumber(const std::string& s) const {
+      for (auto c : s) {
+        if (!std::isdigit(c)) {
+          return false;
+        }
       }
-      return out;
+      return !s.empty();
+    }
+
+    // lines (chunk == 0) or chunks of mapped file
+    static Interpreter::UserIterator sequenceIterator(std::shared_ptr<MappedFile> mf, size_t chunk) {
+      return [mf, chunk, pos = size_t(0)](std::string& outValue) mutable {
+        if (pos >= mf->size())
+          return false;
+        const char* begin = mf->data() + pos;
+        size_t len = std::min(chunk, mf->size() - pos);
+        if (chunk == 0) {
+          auto end = static_cast<const char*>(memchr(begin, '\n', mf->size() - pos));
+          len = end ? size_t(end - begin) : mf->size() - pos;
+          pos += 1;  // '\n'
+        }
+        pos += len;
+        outValue.assign(begin, len);
+        return true;
+      };
+    }
+
+    void flushWriter(const std::string& path) {
+      auto it = m_writer.find(path);
+      if (it != m_writer.end())
+        it->second.flush();
+    }
+
+    std::string getContrNameByFunction(size_t funcIndex){
+      // the function is called as "name.func(...)", the names are taken without copies of entities
+      if ((funcIndex >= 2) && (m_intr.getNameByIndex(funcIndex - 1) == "."))
+        return m_intr.getNameByIndex(funcIndex - 2);
+      return std::string();
     }
 
   protected:
     Interpreter& m_intr;
     std::map<std::string, std::string> m_fileHandler;
     std::map<std::string, std::string> m_dirHandler;
+    std::unordered_map<std::string, std::ofstream> m_writer;  // by path, are open until the file is reassigned or closed
+    struct Sequence {
+      std::string file;  // name of file handler
+      size_t chunk;      // 0 - lines
+    };
+    std::map<std::string, Sequence> m_sequence;
   };
 }
\ No newline at end of file
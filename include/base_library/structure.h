@@ -1,8 +1,12 @@
 
 #include "../../include/interpreter.h"
 
+#include <algorithm>
 #include <cctype>
+#include <map>
+#include <memory>
 #include <sstream>
+#include <unordered_map>
 
 namespace InterpreterBaseLib {
 
@@ -35,9 +39,9 @@ namespace InterpreterBaseLib {
       ir.addOperator("=", [this, currOperator](std::string& leftOpd, std::string& rightOpd) ->std::string {
         
         if (rightOpd == "Struct") {
-          m_structContr[leftOpd] = "";
+          std::vector<std::string> fields, values;
 
-          auto entityRight = m_intr.getEntityByIndex(m_intr.currentEntity().beginIndex + 1);
+          auto entityRight = m_intr.getEntityByIndex(m_intr.currentIndex() + 1);
 
           std::string& initBody = entityRight.value;
 
@@ -48,8 +52,6 @@ namespace InterpreterBaseLib {
               cp = 0;
             int bordCnt = 0;
 
-            Interpreter intrCopy = m_intr;
-
             while (cp < ssz) {
               if (initBody[cp] == '(') ++bordCnt;
               if (initBody[cp] == ')') --bordCnt;
@@ -58,56 +60,151 @@ namespace InterpreterBaseLib {
                 if (cp == ssz - 1) ++cp;
 
                 auto args = split(initBody.substr(cpos, cp - cpos), ':');
-                std::string err;
-                if ((args.size() > 1) && intrCopy.parseScript(args[1], err))
-                  m_structContr[leftOpd + '.' + args[0]] = intrCopy.runScript();
-                else if (!args.empty())
-                  m_structContr[leftOpd + '.' + args[0]] = "";
-
+                std::string err, value;
+                if (!args.empty()) {
+                  if ((args.size() > 1) && !m_intr.evalScript(args[1], value, err))
+                    value.clear();
+                  auto itField = std::find(fields.begin(), fields.end(), args[0]);
+                  if (itField != fields.end())
+                    values[itField - fields.begin()] = value;
+                  else {
+                    fields.push_back(args[0]);
+                    values.push_back(value);
+                  }
+                }
                 cpos = cp + 1;
               }
               ++cp;
             }
-          }         
+          }
+          Record& rec = m_record[leftOpd];
+          rec.schema = schema(fields);
+          rec.value = std::move(values);
+        }
+        else if (Record* rec = fieldRecord(leftOpd)) {
+          rec->value[m_target.index] = rightOpd;
+          m_target.rec = nullptr;
+          return rightOpd;
         }
-        else if (m_structContr.count(leftOpd)) {
-          m_structContr[leftOpd] = rightOpd;
+        else if (m_record.count(leftOpd)) {
           return rightOpd;
         }
         else if (currOperator){
           return currOperator(leftOpd, rightOpd);
         }
         return leftOpd + '=' + rightOpd;
-      }, 100);
+      }, 100, false, Interpreter::OperandMutability::LEFT);
 
       currOperator = ir.getUserOperator(".");
-      ir.addOperator(".", [this, currOperator](std::string& leftOpd, std::string& rightOpd) -> std::string {
+      ir.addOperatorView(".", [this, currOperator](const std::string& leftOpd, const std::string& rightOpd) -> std::string {
         
-        if (m_structContr.count(leftOpd)) {
-
-          if (isEqualOfNextOperator(m_intr.currentEntity().beginIndex)) {
-            if (!m_structContr.count(leftOpd + '.' + rightOpd))
-              m_structContr[leftOpd + '.' + rightOpd] = "";
+        const size_t iOpr = m_intr.currentIndex();
+        if (m_site.size() <= iOpr)
+          m_site.resize(iOpr + 1);
+        Site& site = m_site[iOpr];
+        if (!site.name || (*site.name != leftOpd)) {
+          auto itRec = m_record.find(leftOpd);
+          if (itRec != m_record.end())
+            site = Site{ &itRec->first, &itRec->second, nullptr, 0 };
+          else if (currOperator) {
+            std::string lOpd = leftOpd, rOpd = rightOpd;
+            return currOperator(lOpd, rOpd);
+          }
+          else
             return leftOpd + '.' + rightOpd;
+        }
+        Record& rec = *site.rec;
+        const bool isAssign = isEqualOfNextOperator(iOpr);
+        if ((site.schema != rec.schema) || (rec.schema->names[site.index] != rightOpd)) {
+          auto itField = rec.schema->index.find(rightOpd);
+          if (itField != rec.schema->index.end())
+            site.index = itField->second;
+          else if (isAssign) {  // new field
+            std::vector<std::string> fields = rec.schema->names;
+            fields.push_back(rightOpd);
+            rec.schema = schema(fields);
+            rec.value.emplace_back();
+            site.index = fields.size() - 1;
           }
-          else {
-            return m_structContr[leftOpd + '.' + rightOpd];
-          }          
+          else
+            return "";
+          site.schema = rec.schema;
         }
-        else if (currOperator) {
-          return currOperator(leftOpd, rightOpd);
+        if (isAssign) {
+          m_target = Target{ site.name, site.rec, site.index };
+          return leftOpd + '.' + rightOpd;
         }
-        return leftOpd + '.' + rightOpd;
+        return rec.value[site.index];
       }, 0);
     }
 
     bool isEqualOfNextOperator(size_t beginIndex){
             
-      return m_intr.getEntityByIndex(beginIndex + 2).name == "=";        
+      return m_intr.getNameByIndex(beginIndex + 2) == "=";
     }
 
   protected:
+    struct Schema {
+      std::vector<std::string> names;                 // field by index
+      std::unordered_map<std::string, size_t> index;  // index by field
+    };
+    struct Record {
+      const Schema* schema = nullptr;
+      std::vector<std::string> value;  // by index of field
+    };
+    struct Site {  // call site of operator '.'
+      const std::string* name = nullptr;  // key of record in m_record
+      Record* rec = nullptr;
+      const Schema* schema = nullptr;     // schema of the field index
+      size_t index = 0;
+    };
+    struct Target {  // field "name.field" for the next operator '='
+      const std::string* name = nullptr;
+      Record* rec = nullptr;
+      size_t index = 0;
+    };
+
+    // the structs with the same fields share the schema, schemas are not removed
+    const Schema* schema(const std::vector<std::string>& fields) {
+      std::string key;
+      for (auto& f : fields)
+        key += f + ',';
+      auto& sch = m_schema[key];
+      if (!sch) {
+        sch.reset(new Schema{ fields, {} });
+        for (size_t i = 0; i < fields.size(); ++i)
+          sch->index[fields[i]] = i;
+      }
+      return sch.get();
+    }
+
+    // record of the left operand "name.field" of operator '=', the index of field is in m_target
+    Record* fieldRecord(const std::string& opd) {
+      if (m_target.rec && (m_target.index < m_target.rec->schema->names.size())) {
+        const std::string& name = *m_target.name,
+                         & field = m_target.rec->schema->names[m_target.index];
+        if ((opd.size() == name.size() + field.size() + 1) && (opd.compare(0, name.size(), name) == 0) &&
+            (opd[name.size()] == '.') && (opd.compare(name.size() + 1, field.size(), field) == 0))
+          return m_target.rec;
+      }
+      // the field was taken by another '.' before this operator
+      size_t dot = opd.find('.');
+      if (dot == std::string::npos)
+        return nullptr;
+      auto itRec = m_record.find(opd.substr(0, dot));
+      if (itRec == m_record.end())
+        return nullptr;
+      auto itField = itRec->second.schema->index.find(opd.substr(dot + 1));
+      if (itField == itRec->second.schema->index.end())
+        return nullptr;
+      m_target = Target{ &itRec->first, &itRec->second, itField->second };
+      return &itRec->second;
+    }
+
     Interpreter& m_intr;
-    std::map<std::string, std::string> m_structContr;
+    std::unordered_map<std::string, Record> m_record;  // by name, the records are not removed
+    std::map<std::string, std::unique_ptr<Schema>> m_schema;  // by fields
+    std::vector<Site> m_site;  // by index of operator '.'
+    Target m_target;
   };
-}
\ No newline at end of file
+}
@@ -8,8 +8,12 @@ namespace InterpreterBaseLib {
       
     Types(Interpreter& ir):
       m_intr(ir)
-    {      
-      ir.addOperator(":", [this](std::string& leftOpd, std::string& rightOpd) ->std::string {
+    {
+      // the static types of variables, "$a: int" is checked while parsing of script
+      ir.addType("int", Interpreter::ValueType::INT);
+      ir.addType("str", Interpreter::ValueType::STRING);
+
+      ir.addOperatorView(":", [this](const std::string& leftOpd, const std::string& rightOpd) ->std::string {
 
         m_types[leftOpd] = rightOpd;
         return leftOpd;
@@ -17,6 +21,10 @@ namespace InterpreterBaseLib {
 
       ir.addFunction("type", [this](const std::vector<std::string>& args) ->std::string {
 
+        std::string vtype = declaredType(m_intr.currentIndex());
+        if (!vtype.empty()){
+          return vtype;
+        }
         if (!args.empty() && m_types.count(args[0])){
           return m_types[args[0]];
         }
@@ -24,6 +32,15 @@ namespace InterpreterBaseLib {
       });
     }
   protected:
+    // the declared type, if the only argument of function is a variable
+    std::string declaredType(size_t iFunc){
+      const size_t iArg = iFunc + 1, iVar = iFunc + 2;
+      if ((m_intr.getEntityByIndex(iFunc).conditionEndIndex != iVar + 1)) return "";
+      const Interpreter::Entity arg = m_intr.getEntityByIndex(iArg);
+      if ((arg.type != Interpreter::EntityType::ARGUMENT) || (arg.bodyEndIndex != iVar + 1)) return "";
+      const Interpreter::Entity var = m_intr.getEntityByIndex(iVar);
+      return var.type == Interpreter::EntityType::VARIABLE ? m_intr.variableType(var.name) : "";
+    }
     Interpreter& m_intr;
     std::map<std::string, std::string> m_types;
   };
@@ -26,9 +26,11 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 #include <functional>
+#include <memory>
 #include <cstdint>
 
 
@@ -37,6 +39,32 @@ class Interpreter {
 public:
   using UserFunction = std::function<std::string(const std::vector<std::string>& args)>;
   using UserOperator = std::function<std::string(std::string& ioLeftOperand, std::string& ioRightOperand)>;
+  using UserOperatorView = std::function<std::string(const std::string& leftOperand, const std::string& rightOperand)>;
+  using UserOperatorInt64 = std::function<bool(int64_t& ioLeftOperand, int64_t& ioRightOperand, int64_t& outResult)>;
+  using UserOperatorDouble = std::function<bool(double& ioLeftOperand, double& ioRightOperand, double& outResult)>;
+
+  /// Arguments of function, valid only while the function runs
+  class ArgsView {
+  public:
+    ArgsView(const std::string_view* data, size_t size) : m_data(data), m_size(size) {}
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const std::string_view& operator[](size_t i) const { return m_data[i]; }
+    const std::string_view* begin() const { return m_data; }
+    const std::string_view* end() const { return m_data + m_size; }
+  private:
+    const std::string_view* m_data;
+    size_t m_size;
+  };
+  using UserFunctionView = std::function<void(ArgsView args, std::string& outResult)>;
+
+  /// Iterator of loop "while($v : container)", lives while the loop runs
+  /// @param outValue next value of $v
+  /// @return false - end of container
+  using UserIterator = std::function<bool(std::string& outValue)>;
+  /// @param container value of expression to the right of ':'
+  /// @return iterator or empty function if the container is unknown
+  using UserIterable = std::function<UserIterator(const std::string& container)>;
     
   explicit 
   Interpreter();
@@ -50,15 +78,80 @@ public:
   /// Add function
   /// @param name
   /// @param ufunc function
+  /// @param pure result depends only on args, the call can be calculated when parsing
+  /// return true - ok
+  bool addFunction(const std::string& name, UserFunction ufunc, bool pure = false);
+
+  /// Add function without copies of arguments.
+  /// The result is written to the buffer of caller, it is empty on call and is reused between calls
+  /// @param name
+  /// @param ufunc function
+  /// @param pure result depends only on args, the call can be calculated when parsing
+  /// return true - ok
+  bool addFunctionView(const std::string& name, UserFunctionView ufunc, bool pure = false);
+
+  /// Operands that are changed by operator
+  enum class OperandMutability {
+    BOTH,
+    LEFT,
+    RIGHT,
+    NONE,
+  };
+
+  /// Add operator.
+  /// Changed variable operands are bound to the operator without copies,
+  /// the operands which are not declared as changed are passed as copies
+  /// @param name
+  /// @param uopr operator
+  /// @param priority
+  /// @param pure result depends only on operands and they are not changed
+  /// @param mutability changed operands, the pure operator changes nothing
   /// return true - ok
-  bool addFunction(const std::string& name, UserFunction ufunc);
+  bool addOperator(const std::string& name, UserOperator uopr, uint32_t priority, bool pure = false,
+                   OperandMutability mutability = OperandMutability::BOTH);
 
-  /// Add operator
+  /// Add operator which does not change operands, they are passed without copies
   /// @param name
   /// @param uopr operator
   /// @param priority
+  /// @param pure result depends only on operands
+  /// return true - ok
+  bool addOperatorView(const std::string& name, UserOperatorView uopr, uint32_t priority, bool pure = false);
+
+  /// Add fast path of operator for integer operands.
+  /// The operator must be added before, it remains as fallback (if uopr returns false)
+  /// @param name
+  /// @param uopr operator
+  /// return true - ok
+  bool addOperatorInt64(const std::string& name, UserOperatorInt64 uopr);
+
+  /// Add fast path of operator for floating point operands.
+  /// The operator must be added before, it remains as fallback (if uopr returns false)
+  /// @param name
+  /// @param uopr operator
   /// return true - ok
-  bool addOperator(const std::string& name, UserOperator uopr, uint32_t priority);
+  bool addOperatorDouble(const std::string& name, UserOperatorDouble uopr);
+
+  /// Add iterable containers for loop "while($v : container)".
+  /// The container is calculated once on entry into the loop, the last added iterable is asked first.
+  /// If no one returns an iterator, the operator ':' is called on every iteration
+  /// @param uiter
+  /// return true - ok
+  bool addIterable(UserIterable uiter);
+
+  /// Static type of variable
+  enum class ValueType {
+    INT,     // integer
+    STRING,  // any value
+  };
+
+  /// Add type for declaration of variables in script "$a: int = 5", the declaration is taken when parsing.
+  /// The script is not parsed if a constant or a variable of other type is assigned to the variable
+  /// (by operator which changes it). Operators on integer operands call the integer fast path directly
+  /// @param name
+  /// @param type
+  /// return true - ok
+  bool addType(const std::string& name, ValueType type);
 
   /// Add attribute
   /// @param name
@@ -79,6 +172,15 @@ public:
   /// return result
   std::string runScript();
 
+  /// Parse and run script on the current variables of interpreter, without a copy of interpreter.
+  /// Can be called from a user function or operator while the script runs,
+  /// the changes of variables are not saved
+  /// @param script
+  /// @param outResult
+  /// @param outErr
+  /// return true - ok
+  bool evalScript(const std::string& script, std::string& outResult, std::string& outErr);
+
   /// All variables
   /// @return vname, value
   std::map<std::string, std::string> allVariables() const;
@@ -88,6 +190,11 @@ public:
   /// @return value
   std::string variable(const std::string& vname) const;
 
+  /// Type of variable declared in the parsed script
+  /// @param vname
+  /// @return type name or empty
+  std::string variableType(const std::string& vname) const;
+
   /// Run of user function
   /// @param fname
   /// @param args
@@ -100,9 +207,9 @@ public:
   /// @return true - ok
   bool setVariable(const std::string& vname, const std::string& value);
 
-  /// Set macro
-  /// @param mname
-  /// @param script
+  /// Set macro, the body is prepared once for all uses
+  /// @param mname name with '#'
+  /// @param script body, arguments are $0, $1, ..
   /// @return true - ok
   bool setMacro(const std::string& mname, const std::string& script);
 
@@ -113,7 +220,85 @@ public:
     
   /// Exit from script
   void exitFromScript();
-  
+
+  /// Run script on bytecode (default) or walk on entities
+  /// @param on
+  void useBytecode(bool on);
+
+  /// Capacity of cache of parsed scripts (0 - off, default 16)
+  /// @param capacity max count of scripts
+  void setScriptCacheCapacity(size_t capacity);
+
+  /// Statistics of cache of parsed scripts
+  /// @param outHits script was not parsed again
+  /// @param outMisses script was parsed
+  void scriptCacheStat(size_t& outHits, size_t& outMisses) const;
+
+  /// Size of the last parsed script after expansion of macros, without spaces and comments
+  /// @return size
+  size_t macroExpandedSize() const;
+
+  /// Max depth of calls of script functions (default 1000).
+  /// A deeper call is not made and returns empty result
+  /// @param depth
+  void setMaxCallDepth(size_t depth);
+
+  enum class RunStatus {
+    OK,
+    STEP_LIMIT,  // run returns "Error: step limit"
+    TIMEOUT,     // run returns "Error: timeout"
+    CANCELLED,   // run returns "Error: cancelled"
+  };
+
+  /// Limits of one run of script (0 - no limit)
+  /// @param maxSteps max count of calls of operators and functions and iterations of loops
+  /// @param timeoutMs max time of run, ms
+  void setRunLimits(size_t maxSteps, size_t timeoutMs);
+
+  /// Stop the current run or the next one if there is no run now, can be called from another thread
+  void cancel();
+
+  /// Status of the last run
+  RunStatus runStatus() const;
+
+  /// Calculate constant expressions and drop dead branches when parsing (default off).
+  /// Only pure operators and functions are calculated
+  /// @param on
+  void useOptimization(bool on);
+
+  /// Parsed script, is not changed after parsing and can be shared between threads
+  class CompiledScript;
+
+  /// Variables and run state of compiled script.
+  /// Contexts of one compiled script can run at the same time in different threads
+  /// (user functions and operators must be thread safe then)
+  class ExecutionContext;
+
+  /// Parse script for execution contexts
+  /// @param script
+  /// @param outErr
+  /// @return compiled script or nullptr on error
+  std::shared_ptr<const CompiledScript> compileScript(std::string script, std::string& outErr);
+
+  /// Statistics of batch run
+  struct BatchStat {
+    size_t threads = 0;
+    std::vector<size_t> runsByThread; // count of inputs run by thread
+    size_t steals = 0;                // count of inputs parts taken from other threads
+    double seconds = 0;               // wall time with parsing
+    double runsPerSecond = 0;
+  };
+
+  /// Run script for every set of variables in several threads, the script is parsed once.
+  /// Every input starts with the variables of interpreter
+  /// @param script
+  /// @param inputs vname, value
+  /// @param threads count of threads (0 - count of cores)
+  /// @param outStat statistics, optional
+  /// @return results in order of inputs or error of parsing
+  std::vector<std::string> runBatch(const std::string& script, const std::vector<std::map<std::string, std::string>>& inputs,
+                                    size_t threads, BatchStat* outStat = nullptr);
+
 
   //// Reflection part ////////////////////////////////////
 
@@ -152,6 +337,12 @@ public:
   /// Entity by index
   Entity getEntityByIndex(size_t beginIndex);
 
+  /// Index of current entity, without copy of entity
+  size_t currentIndex();
+
+  /// Name of entity by index, without copy of entity
+  const std::string& getNameByIndex(size_t beginIndex);
+
   /// Attribute by index
   std::vector<std::string> getAttributeByIndex(size_t beginIndex);
 
@@ -163,9 +354,75 @@ public:
 
   UserOperator getUserOperator(const std::string& oname);
 
+  /// Statistics of entity from profiler
+  struct EntityProfile {
+    Entity entity;
+    size_t hits;          // count of calls of operator or function, count of runs of loop
+    uint64_t nanoseconds; // cumulative time with nested calls
+  };
+
+  /// Profiler of operators, functions and loops (default off).
+  /// Statistics is accumulated by runs and is reset on parsing of another script
+  /// @param on
+  void useProfiler(bool on);
+
+  /// Statistics of entities of script with hits > 0
+  std::vector<EntityProfile> profile();
+
+  /// Profile as folded stacks for flamegraph tools, line per stack: "script;while@2;summ@7 1200" (own time, ns)
+  std::string profileFolded() const;
+
   //// Reflection part ////////////////////////////////////
 
 private:
   class Impl;
   Impl* m_d = nullptr;
+};
+
+class Interpreter::ExecutionContext {
+
+public:
+  /// Variables of context are the variables of interpreter when the script was compiled
+  /// @param script compiled script
+  explicit
+  ExecutionContext(std::shared_ptr<const CompiledScript> script);
+  ~ExecutionContext();
+
+  ExecutionContext(const ExecutionContext&) = delete;
+  ExecutionContext(ExecutionContext&&);
+  ExecutionContext& operator=(const ExecutionContext&) = delete;
+  ExecutionContext& operator=(ExecutionContext&&);
+
+  /// Run compiled script
+  /// @return result
+  std::string run();
+
+  /// Limits of one run (0 - no limit), default are the limits of interpreter
+  /// @param maxSteps max count of calls of operators and functions and iterations of loops
+  /// @param timeoutMs max time of run, ms
+  void setRunLimits(size_t maxSteps, size_t timeoutMs);
+
+  /// Stop the current run or the next one if there is no run now, can be called from another thread
+  void cancel();
+
+  /// Status of the last run
+  Interpreter::RunStatus runStatus() const;
+
+  /// Set value of variable
+  /// @param vname variable of script
+  /// @param value
+  /// @return true - ok
+  bool setVariable(const std::string& vname, const std::string& value);
+
+  /// Value of variable
+  /// @param vname
+  /// @return value
+  std::string variable(const std::string& vname) const;
+
+  /// All variables
+  /// @return vname, value
+  std::map<std::string, std::string> allVariables() const;
+
+private:
+  Interpreter::Impl* m_d = nullptr;
 };
\ No newline at end of file
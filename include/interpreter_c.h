@@ -36,6 +36,7 @@
 #define INTERPRETER_API
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 #if defined(__cplusplus)
@@ -47,11 +48,24 @@ typedef enum BOOL{ FALSE = 0, TRUE = 1}BOOL;
 typedef char*(*irUserFunction)(char** args, size_t count);
 typedef char*(*irUserOperator)(char** ioLeftOperand, char** ioRightOperand);
 
+/// String without copy, is not null-terminated
+typedef struct irStr{ const char* data; size_t size; }irStr;
+
+/// Function without copies of arguments, the args are valid while the function runs.
+/// The result is copied by interpreter after return
+typedef irStr(*irUserFunctionView)(const irStr* args, size_t count, void* userData);
+
+/// Operator without copies of operands. To change an operand, set it to other string,
+/// it is copied by interpreter after return as the result
+typedef irStr(*irUserOperatorView)(irStr* ioLeftOperand, irStr* ioRightOperand, void* userData);
+
 typedef void* HIntr;
 
 
 INTERPRETER_API HIntr irCreateIntr();
 
+INTERPRETER_API void irDeleteIntr(HIntr);
+
 /// Add function
 /// @param name
 /// @param ufunc function
@@ -64,6 +78,21 @@ INTERPRETER_API BOOL irAddFunction(HIntr, char* name, irUserFunction ufunc);
 /// @param priority
 /// return true - ok
 INTERPRETER_API BOOL irAddOperator(HIntr, char* name, irUserOperator uopr, uint32_t priority);
+
+/// Add function without copies of arguments
+/// @param name
+/// @param ufunc function
+/// @param userData is passed to function
+/// return true - ok
+INTERPRETER_API BOOL irAddFunctionView(HIntr, const char* name, irUserFunctionView ufunc, void* userData);
+
+/// Add operator without copies of operands
+/// @param name
+/// @param uopr operator
+/// @param priority
+/// @param userData is passed to operator
+/// return true - ok
+INTERPRETER_API BOOL irAddOperatorView(HIntr, const char* name, irUserOperatorView uopr, uint32_t priority, void* userData);
    
 /// Execute script (== parseScript + runScript)
 /// @param script
@@ -84,6 +113,49 @@ INTERPRETER_API char* irRunScript(HIntr);
 /// @return value
 INTERPRETER_API char* irVariable(HIntr, char* vname);
 
+/// Execute script, the result is kept by interpreter until the next call with this handle
+/// @param script
+/// @param outSize size of result, optional
+/// @return result or error, null-terminated
+INTERPRETER_API const char* irCmdRef(HIntr, const char* script, size_t* outSize);
+
+/// Run script, the result is kept by interpreter until the next call with this handle
+/// @param outSize size of result, optional
+/// @return result, null-terminated
+INTERPRETER_API const char* irRunScriptRef(HIntr, size_t* outSize);
+
+/// Value of variable, is kept by interpreter until the next call with this handle
+/// @param vname
+/// @param outSize size of value, optional
+/// @return value, null-terminated
+INTERPRETER_API const char* irVariableRef(HIntr, const char* vname, size_t* outSize);
+
+/// Execute script, the result is written to buffer of caller
+/// @param script
+/// @param outBuff
+/// @param buffSize
+/// @return size of result, the result is truncated if size >= buffSize (irLastResult returns it whole)
+INTERPRETER_API size_t irCmdBuff(HIntr, const char* script, char* outBuff, size_t buffSize);
+
+/// Run script, the result is written to buffer of caller
+/// @param outBuff
+/// @param buffSize
+/// @return size of result, the result is truncated if size >= buffSize (irLastResult returns it whole)
+INTERPRETER_API size_t irRunScriptBuff(HIntr, char* outBuff, size_t buffSize);
+
+/// Value of variable is written to buffer of caller
+/// @param vname
+/// @param outBuff
+/// @param buffSize
+/// @return size of value, the value is truncated if size >= buffSize
+INTERPRETER_API size_t irVariableBuff(HIntr, const char* vname, char* outBuff, size_t buffSize);
+
+/// Result of the last call of irCmdRef, irRunScriptRef, irCmdBuff or irRunScriptBuff
+/// @param outBuff
+/// @param buffSize
+/// @return size of result, the result is truncated if size >= buffSize
+INTERPRETER_API size_t irLastResult(HIntr, char* outBuff, size_t buffSize);
+
 /// Set value of variable
 /// @param vname
 /// @param value
@@ -0,0 +1,358 @@
+//
+// Interpreter Project
+// Copyright (C) 2020 by Contributors <https://github.com/Tyill/interpreter>
+//
+// This code is licensed under the MIT License.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#include <benchmark/benchmark.h>
+#include "../include/interpreter.h"
+#include "../include/base_library/arithmetic_operations.h"
+#include "../include/base_library/comparison_operations.h"
+#include "../include/base_library/containers.h"
+#include "../include/base_library/filesystem.h"
+#include "../include/base_library/structure.h"
+#include "../include/base_library/types.h"
+
+#include <atomic>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+static atomic<size_t> g_allocBytes{ 0 };  // bytes allocated by operator new
+
+static void* countedAlloc(size_t size) {
+  g_allocBytes.fetch_add(size, memory_order_relaxed);
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw bad_alloc();
+}
+
+// the whole family is replaced, so that every form of new is paired with free
+void* operator new(size_t size) {
+  return countedAlloc(size);
+}
+void* operator new[](size_t size) {
+  return countedAlloc(size);
+}
+void operator delete(void* p) noexcept {
+  free(p);
+}
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+
+bool isNumber(const string& s) {
+  for (auto c : s) {
+    if (!std::isdigit(c)) {
+      return false;
+    }
+  }
+  return !s.empty();
+}
+
+class BenchInterpreter {
+public:
+  BenchInterpreter() :
+  ao_ir(ir),
+  co_ir(ir),
+  ts_ir(ir),
+  bc_ir(ir),
+  fs_ir(ir),
+  st_ir(ir){
+
+    ir.addFunction("summ", [](const vector<string>& args) ->string {
+      int res = 0;
+      for (auto& v : args) {
+        if (isNumber(v)) res += stoi(v);
+      }
+      return to_string(res);
+    });
+  }
+  Interpreter ir;
+  InterpreterBaseLib::ArithmeticOperations ao_ir;
+  InterpreterBaseLib::ComparisonOperations co_ir;
+  InterpreterBaseLib::Types ts_ir;
+  InterpreterBaseLib::Container bc_ir;
+  InterpreterBaseLib::Filesystem fs_ir;
+  InterpreterBaseLib::Structure st_ir;
+};
+
+// ops/s and bytes allocated by one iteration
+static void setCounters(benchmark::State& state, size_t allocBytes) {
+  state.counters["ops/s"] = benchmark::Counter(double(state.iterations()), benchmark::Counter::kIsRate);
+  state.counters["bytes/op"] = benchmark::Counter(double(allocBytes), benchmark::Counter::kAvgIterations);
+}
+
+// the script is parsed once, every iteration is a run
+static void runScript(benchmark::State& state, BenchInterpreter& bi, const string& script, const string& expected) {
+
+  string err;
+  if (!bi.ir.parseScript(script, err)) {
+    state.SkipWithError(err.c_str());
+    return;
+  }
+  if (bi.ir.runScript() != expected) {
+    state.SkipWithError("unexpected result");
+    return;
+  }
+  size_t allocBegin = g_allocBytes.load();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(bi.ir.runScript());
+  }
+  setCounters(state, g_allocBytes.load() - allocBegin);
+}
+
+//// Parser ////////////////////////////////////
+
+static string statements(size_t count) {
+  string script;
+  for (size_t i = 0; i < count; ++i) {
+    script += "$a" + to_string(i % 16) + " = summ($b, " + to_string(i) + ") + 2 * ($c - 1); ";
+    if (i % 8 == 7)
+      script += "if ($a1 > 5) { $b += 1; } else { $c = \"value " + to_string(i) + "\"; } ";
+  }
+  return script;
+}
+static void BM_parseScript(benchmark::State& state) {
+
+  BenchInterpreter bi;
+  bi.ir.setScriptCacheCapacity(0);
+
+  // the previous script is not parsed again, so two scripts in turn
+  const string script[2] = { statements(state.range(0)), statements(state.range(0)) + " $d = 0;" };
+  string err;
+  size_t iScript = 0, allocBegin = g_allocBytes.load();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(bi.ir.parseScript(script[iScript], err));
+    iScript ^= 1;
+  }
+  setCounters(state, g_allocBytes.load() - allocBegin);
+  state.SetBytesProcessed(state.iterations() * int64_t(script[0].size()));
+}
+BENCHMARK(BM_parseScript)->Arg(4)->Arg(512);
+
+// range(0) nested blocks with statements and calls, every level is a part of the script
+static void BM_parseNested(benchmark::State& state) {
+
+  BenchInterpreter bi;
+  bi.ir.setScriptCacheCapacity(0);
+
+  string script;
+  for (int64_t i = 0; i < state.range(0); ++i)
+    script += "if ($a" + to_string(i % 16) + " < summ($b, (" + to_string(i) + "))) { $c = summ($c, 1); ";
+  script += string(size_t(state.range(0)), '}');
+  const string scripts[2] = { script, script + " $d = 0;" };
+  string err;
+  size_t iScript = 0, allocBegin = g_allocBytes.load();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(bi.ir.parseScript(scripts[iScript], err));
+    iScript ^= 1;
+  }
+  setCounters(state, g_allocBytes.load() - allocBegin);
+  state.SetBytesProcessed(state.iterations() * int64_t(script.size()));
+}
+BENCHMARK(BM_parseNested)->Arg(256);
+
+// range(0) uses of macro with arguments, the macro uses other macro
+static void BM_parseMacros(benchmark::State& state) {
+
+  BenchInterpreter bi;
+  bi.ir.setScriptCacheCapacity(0);
+  bi.ir.setMacro("#ADD", "$0 += $1 * 2;");
+  bi.ir.setMacro("#STEP", "#ADD($0, $1) #ADD($1, 1) if ($0 > 100) { $0 = 0; }");
+
+  string uses;
+  for (int64_t i = 0; i < state.range(0); ++i)
+    uses += "#STEP($a" + to_string(i % 4) + ", $b) ";
+  const string script[2] = { uses, uses + " $d = 0;" };
+  string err;
+  size_t iScript = 0, allocBegin = g_allocBytes.load();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(bi.ir.parseScript(script[iScript], err));
+    iScript ^= 1;
+  }
+  setCounters(state, g_allocBytes.load() - allocBegin);
+  state.counters["expanded"] = double(bi.ir.macroExpandedSize());
+}
+BENCHMARK(BM_parseMacros)->Arg(512);
+
+//// Evaluator ////////////////////////////////////
+
+static void BM_whileArithmetic(benchmark::State& state) {
+  BenchInterpreter bi;
+  runScript(state, bi, "$a = 0; $s = 0; while ($a < 1000) { $a += 1; $s = $s + $a * 2 - 1; }; $s", "1000000");
+}
+BENCHMARK(BM_whileArithmetic);
+
+// generated formula of 64 operators, range(0): 1 - bytecode, 0 - walk on entities
+static void BM_formula(benchmark::State& state) {
+  BenchInterpreter bi;
+  bi.ir.useBytecode(state.range(0) != 0);
+  string formula = "$x";
+  for (int i = 0; i < 32; ++i)
+    formula += " + " + to_string(i) + " * $x";
+  runScript(state, bi, "$x = 2; $r = 0; $i = 0; while ($i < 10) { $r = " + formula + "; $i += 1; }; $r", "994");
+}
+BENCHMARK(BM_formula)->Arg(1)->Arg(0);
+
+// operands are strings of range(0) bytes
+static void BM_stringCompare(benchmark::State& state) {
+  BenchInterpreter bi;
+  const string data(state.range(0), 'a');
+  bi.ir.cmd("$a = 0; $b = 0;");
+  bi.ir.setVariable("$a", data);
+  bi.ir.setVariable("$b", data);
+  runScript(state, bi, "$n = 0; $i = 0; while ($i < 100) { if ($a == $b) $n += 1; $i += 1; }; $n", "100");
+}
+BENCHMARK(BM_stringCompare)->Arg(65536);
+
+static void BM_stringAppend(benchmark::State& state) {
+  BenchInterpreter bi;
+  const string data(state.range(0), 'a');
+  bi.ir.cmd("$line = 0;");
+  bi.ir.setVariable("$line", data);
+  runScript(state, bi, "$buf = begin; $i = 0; while ($i < 100) { $buf += $line; $i += 1; }; $i", "100");
+}
+BENCHMARK(BM_stringAppend)->Arg(4096);
+
+static void BM_summNested(benchmark::State& state) {
+  BenchInterpreter bi;
+  runScript(state, bi, "$a = 5; $b = 2; $c = summ($a, summ($a, summ($b, summ(1, 2))), summ(summ(3), 4)); $c", "22");
+}
+BENCHMARK(BM_summNested);
+
+static void BM_summNestedView(benchmark::State& state) {
+  BenchInterpreter bi;
+  bi.ir.addFunctionView("summ", [](Interpreter::ArgsView args, string& outResult) {
+    int res = 0;
+    for (string_view v : args) {
+      int n = 0;
+      if (from_chars(v.data(), v.data() + v.size(), n).ec == errc()) res += n;
+    }
+    outResult = to_string(res);
+  });
+  runScript(state, bi, "$a = 5; $b = 2; $c = summ($a, summ($a, summ($b, summ(1, 2))), summ(summ(3), 4)); $c", "22");
+}
+BENCHMARK(BM_summNestedView);
+
+static void BM_recursion(benchmark::State& state) {
+  BenchInterpreter bi;
+  runScript(state, bi, "function fib{ if ($0 < 2) $r = $0; else $r = fib($0 - 1) + fib($0 - 2); $r }; fib(15)", "610");
+}
+BENCHMARK(BM_recursion);
+
+//// Base library ////////////////////////////////////
+
+static void BM_vector(benchmark::State& state) {
+  BenchInterpreter bi;
+  runScript(state, bi, "a = Vector; $i = 0; while ($i < 100) { a.push_back($i); $i += 1; }; "
+                       "$s = 0; while ($v : a) { $s += $v; }; $s + a[50]", "5000");
+}
+BENCHMARK(BM_vector);
+
+static void BM_vectorIndex(benchmark::State& state) {
+  BenchInterpreter bi;
+  bi.ir.cmd("a = Vector; $i = 0; while ($i < 100) { a.push_back($i); $i += 1; };");
+  runScript(state, bi, "$s = 0; $i = 0; while ($i < 100) { $s += a[$i]; $i += 1; }; $s", "4950");
+}
+BENCHMARK(BM_vectorIndex);
+
+static void BM_map(benchmark::State& state) {
+  BenchInterpreter bi;
+  runScript(state, bi, "b = Map; $i = 0; while ($i < 100) { b.insert($i, $i * 2); $i += 1; }; b[50]", "100");
+}
+BENCHMARK(BM_map);
+
+static void BM_mapIterate(benchmark::State& state) {
+  BenchInterpreter bi;
+  bi.ir.cmd("b = Map; $i = 0; while ($i < " + to_string(state.range(0)) + ") { b.insert($i, $i); $i += 1; };");
+  runScript(state, bi, "$n = 0; while ($v : b) { $n += 1; }; $n", to_string(state.range(0)));
+}
+BENCHMARK(BM_mapIterate)->Arg(1000);
+
+static void BM_struct(benchmark::State& state) {
+  BenchInterpreter bi;
+  runScript(state, bi, "e = Struct{ one : 0, two : 2 }; $i = 0; while ($i < 100) { e.one = e.one + e.two; $i += 1; }; e.one", "200");
+}
+BENCHMARK(BM_struct);
+
+// struct of range(0) fields, 8 fields are read and 2 are written per iteration
+static void BM_structFields(benchmark::State& state) {
+  BenchInterpreter bi;
+  string init;
+  for (int i = 0; i < state.range(0); ++i)
+    init += (i ? ", f" : "f") + to_string(i) + " : " + to_string(i);
+  bi.ir.cmd("e = Struct{ " + init + " };");
+  runScript(state, bi, "$i = 0; while ($i < 100) { e.f0 = e.f1 + e.f2 + e.f3 + e.f4; e.f5 = e.f6 + e.f7 + e.f0; $i += 1; }; e.f5", "23");
+}
+BENCHMARK(BM_structFields)->Arg(24);
+
+// the same loop with and without of declared types
+static void BM_typedLoop(benchmark::State& state) {
+  BenchInterpreter bi;
+  const string decl = state.range(0) ? "$a: int = 0; $s: int = 0; " : "$a = 0; $s = 0; ";
+  runScript(state, bi, decl + "while ($a < 1000) { $s += $a * 2; $a += 1; }; $s", "999000");
+}
+BENCHMARK(BM_typedLoop)->Arg(0)->Arg(1);
+
+static void BM_file(benchmark::State& state) {
+  BenchInterpreter bi;
+  const string data(state.range(0), 'a');
+  bi.ir.cmd("$data = 0;");
+  bi.ir.setVariable("$data", data);
+  runScript(state, bi, "f = File{\"bench_file.txt\"}; f.write($data); f.read()", data);
+  state.SetBytesProcessed(state.iterations() * int64_t(data.size()) * 2);
+  remove("bench_file.txt");
+}
+BENCHMARK(BM_file)->Arg(4096);
+
+static void BM_fileAppend(benchmark::State& state) {
+  BenchInterpreter bi;
+  runScript(state, bi, "f = File{\"bench_file.txt\"}; f.write(0); $i = 0; while ($i < 100) { f.append(\"record\"); $i += 1; }; $i", "100");
+  remove("bench_file.txt");
+}
+BENCHMARK(BM_fileAppend);
+
+static void BM_fileLines(benchmark::State& state) {
+  BenchInterpreter bi;
+  string data;
+  for (int i = 0; i < state.range(0); ++i)
+    data += "line " + to_string(i) + "\n";
+  bi.ir.cmd("$data = 0;");
+  bi.ir.setVariable("$data", data);
+  bi.ir.cmd("f = File{\"bench_file.txt\"}; f.write($data); f.close();");
+  runScript(state, bi, "$n = 0; while ($line : f.lines()) { $n += 1; }; $n", to_string(state.range(0)));
+  state.SetBytesProcessed(state.iterations() * int64_t(data.size()));
+  remove("bench_file.txt");
+}
+BENCHMARK(BM_fileLines)->Arg(1000);
+
+BENCHMARK_MAIN();
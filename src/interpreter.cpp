@@ -25,23 +25,41 @@
 #include "../include/interpreter.h"
 
 #include <sstream>
+#include <deque>
 #include <algorithm>
 #include <cctype>
 #include <set>
+#include <unordered_map>
+#include <memory>
+#include <charconv>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <exception>
+#include <atomic>
 
 using namespace std;
 
 class Interpreter::Impl {
 public:
   Impl() = default;
-  bool addFunction(const string& name, Interpreter::UserFunction ufunc);
-  bool addOperator(const string& name, Interpreter::UserOperator uopr, uint32_t priority);
+  explicit Impl(shared_ptr<const Impl> program);  // execution context of compiled script
+  bool addFunction(const string& name, Interpreter::UserFunction ufunc, bool pure);
+  bool addFunctionView(const string& name, Interpreter::UserFunctionView ufunc, bool pure);
+  bool addOperator(const string& name, Interpreter::UserOperator uopr, uint32_t priority, bool pure, Interpreter::OperandMutability mutability);
+  bool addOperatorView(const string& name, Interpreter::UserOperatorView uopr, uint32_t priority, bool pure);
+  bool addOperatorInt64(const string& name, Interpreter::UserOperatorInt64 uopr);
+  bool addOperatorDouble(const string& name, Interpreter::UserOperatorDouble uopr);
   bool addAttribute(const string& name);
+  bool addIterable(Interpreter::UserIterable uiter);
+  bool addType(const string& name, Interpreter::ValueType type);
   string cmd(string script);
   bool parseScript(string script, string& outErr);
   string runScript();
+  bool evalScript(const string& script, string& outResult, string& outErr);
   std::map<std::string, std::string> allVariables() const;
   std::string variable(const std::string& vname) const;
+  std::string variableType(const std::string& vname) const;
   std::string runFunction(const std::string& fname, const std::vector<std::string>& args);
   bool setVariable(const std::string& vname, const std::string& value);
   bool setMacro(const std::string& mname, const std::string& script);
@@ -50,10 +68,28 @@ public:
   std::vector<Interpreter::Entity> allEntities();
   Interpreter::Entity currentEntity();
   Interpreter::Entity getEntityByIndex(size_t beginIndex);
+  size_t currentIndex() const;
+  const string& getNameByIndex(size_t beginIndex) const;
   vector<string> getAttributeByIndex(size_t beginIndex);
   bool gotoOnEntity(size_t iBegin);
   Interpreter::UserFunction getUserFunction(const std::string& fname);
   Interpreter::UserOperator getUserOperator(const std::string& oname);
+  void useBytecode(bool on);
+  void setScriptCacheCapacity(size_t capacity);
+  void scriptCacheStat(size_t& outHits, size_t& outMisses) const;
+  size_t macroExpandedSize() const;
+  void setMaxCallDepth(size_t depth);
+  void useOptimization(bool on);
+  void cloneInternFunctions();
+  shared_ptr<const Impl> sharedProgram(string script, string& outErr);
+  vector<string> runBatch(const string& script, const vector<map<string, string>>& inputs, size_t threads, Interpreter::BatchStat* outStat);
+  void setRunLimits(size_t maxSteps, size_t timeoutMs);
+  void cancel();
+  Interpreter::RunStatus runStatus() const;
+  void useProfiler(bool on);
+  vector<Interpreter::EntityProfile> profile();
+  string profileFolded() const;
+  static Impl* current(Impl* owner);  // execution context of owner which runs in the thread, or owner
 private:
   enum class Keyword {
     INSTRUCTION,
@@ -72,60 +108,589 @@ private:
     VALUE,
     GOTO,
   };
+  class Value {
+  public:
+    enum class Type : uint8_t {
+      NONE,
+      INT,
+      DOUBLE,
+      STRING,
+    };
+    Value() = default;
+    explicit Value(int64_t v) : m_type(Type::INT), m_int(v) {}
+    explicit Value(double v) : m_type(Type::DOUBLE), m_dbl(v) {}
+    Value(string s);
+    Value(const char* s) : Value(string(s)) {}
+    Type type() const { return m_type; }
+    int64_t toInt() const { return m_type == Type::DOUBLE ? int64_t(m_dbl) : m_int; }
+    double toDouble() const { return m_type == Type::DOUBLE ? m_dbl : double(m_int); }
+    const string& str() const;
+    string release();
+  private:
+    Type m_type = Type::NONE;
+    mutable bool m_hasStr = false;
+    union {
+      int64_t m_int = 0;
+      double m_dbl;
+    };
+    mutable string m_str;
+  };
   struct Expression {
     Keyword keyw;
     size_t iConditionEnd;
     size_t iBodyEnd;
-    size_t iOperator;
+    size_t iPostfix;           // postfix of expression that begins here, index in m_postfix
     string params;
-    string result;
+    Value value;               // value given in script, the result of run is in m_exprResult
+    size_t iVar = size_t(-1); // slot of variable
   };
   struct Operatr {
     size_t inx, priority, iLOpr, iROpr;
+    size_t iLRes, iRRes;  // operand is the result of operator on this position of postfix, NO_OPERAND - the entity
+  };
+  struct UserOperator {
+    Interpreter::UserOperator func;
+    uint32_t priority;
+    Interpreter::UserOperatorInt64 intFunc;   // fast path, optional
+    Interpreter::UserOperatorDouble dblFunc;  // fast path, optional
+    bool pure;  // result depends only on operands, can be calculated when parsing
+    bool lMutable, rMutable;  // operand is changed by operator
+    Interpreter::UserOperatorView view;  // operands are not changed and are passed as is, optional
+  };
+  struct IntKernel {  // integer fast path of operator with operands of static type int
+    Interpreter::UserOperatorInt64 func;
+    bool lMutable, rMutable;
+  };
+  enum class OpCode {
+    LOAD_VARIABLE,   // push value of variable
+    PUSH_VALUE,      // push constant
+    PUSH_RESULT,     // push result of entity
+    STORE_RESULT,    // result of entity = top of stack
+    CALL_OPERATOR,   // a, b - operands: NO_OPERAND, OPERAND, index of variable for write back or BOUND | index of variable
+    CALL_OPERATOR_INT, // same, c - index of kernel
+    CALL_FUNCTION,   // a - count of arguments
+    STATEMENT,       // pop result of expression
+    ENTER,           // a - pc of LEAVE
+    CONDITION,       // a - pc of LEAVE
+    BIND,            // begin iteration of container on top of stack
+    ITERATE,         // next value of loop variable, a - pc of LEAVE
+    LOOP,
+    LEAVE,
+    BREAK,
+    CONTINUE,
+    GOTO,
+  };
+  struct Instruction {
+    OpCode opc;
+    uint32_t c;
+    size_t iExpr, a, b;
+  };
+  struct Binding {  // loop "while($v : container)"
+    Interpreter::UserIterator iter;  // empty - the operator ':' is called
+    Value container;
+    string value;
+  };
+  struct Block {
+    size_t iExpr, iCondPc, iEndPc;
+    string result; // result of enclosing block
+    Binding binding;
+  };
+  static constexpr size_t NO_OPERAND = size_t(-1);
+  static constexpr size_t OPERAND = size_t(-2);
+  static constexpr size_t BOUND = (SIZE_MAX >> 2) + 1;  // flag of variable operand which is not on stack, the operator works on the variable
+  static constexpr size_t MAX_MACRO_DEPTH = 64;   // of macros in macros
+  static constexpr size_t MAX_MACRO_EXPANSIONS = 4096;
+  struct MacroPart {
+    string text;          // before argument
+    size_t iArg;          // index of argument $N, size_t(-1) - end of body
+    string placeholder;   // "$N", is kept if the argument is not given
+  };
+  struct Macro {
+    string body;
+    vector<MacroPart> part;
+  };
+  struct MacroExpansion {
+    string text;
+    vector<string> macroUse;  // the expanded macro and the macros in its body
+  };
+  struct ParseEffects {  // parse-time side effects, replayed on a cache hit
+    vector<pair<size_t, string>> varInit;  // slot, value
+    vector<pair<string, string>> macro;    // mname, script
+    map<string, shared_ptr<Impl>> internFunc;
+  };
+  struct ParsedScript {
+    string script;
+    size_t lastUse;
+    vector<Expression> expr;
+    map<string, size_t> label;
+    map<size_t, vector<string>> exprAttribute;
+    vector<vector<Operatr>> postfix;
+    map<size_t, string> varType;
+    vector<IntKernel> intKernel;
+    vector<Instruction> code;
+    vector<Value> constant;
+    vector<size_t> exprPc;
+    size_t expandedSize;
+    ParseEffects effects;
+    vector<string> macroUse;  // names of the expanded macros
+  };
+  class NameTrie {  // longest match of registered names
+  public:
+    void insert(const string& name);
+    string match(string_view str, size_t& cpos) const;
+  private:
+    struct Node {
+      map<char, size_t> next;
+      bool isEnd = false;
+    };
+    vector<Node> m_nodes = vector<Node>(1);
+  };
+  struct Registry {  // functions, operators, macros and types, script functions share it with the declaring interpreter
+    map<string, Interpreter::UserFunction> ufunc;
+    map<string, Interpreter::UserFunctionView> ufuncView;
+    map<string, UserOperator> uoper;
+    vector<Interpreter::UserIterable> iterable;
+    set<string> pureFunc;
+    map<string, Macro> macro;
+    set<string> attribute;
+    map<string, Interpreter::ValueType> type;  // static types by name
+    NameTrie ufuncNames, uoperNames, macroNames, attributeNames;
+  };
+  struct Frame {  // saved state of active call of script function, the storage is reused by calls of the same depth
+    vector<Value> args;  // by index of argument
+    vector<Value> exprResult;
+    vector<Value> stack;
+    vector<Block> blocks;
+    Value result;
+    string blockResult;
+    size_t gotoIndex, currentIndex, callDepth;
+    bool exit;
+    Impl* caller;
+  };
+  struct Uid {  // identity of object, a copy takes a new one
+    size_t value = next();
+    Uid() = default;
+    Uid(const Uid&) {}
+    Uid& operator=(const Uid&) { return *this; }
+    static size_t next() {
+      static atomic<size_t> counter{ 0 };
+      return ++counter;
+    }
+  };
+  struct Folding {  // constant range of entities, replaced by value
+    size_t iBegin, iEnd;
+    Value value;
+  };
+  struct ArgFrame {  // arguments of call, the storage is reused by calls of the same depth
+    vector<Value> values;
+    vector<string> strs;
+    vector<string_view> views;
+    string result;
+  };
+  class ArgScope {  // frame of arguments while the object lives
+  public:
+    ArgScope(Impl& impl) : m_impl(impl) {
+      if (impl.m_argDepth == impl.m_argFrames.size())
+        impl.m_argFrames.emplace_back();
+      frame = &impl.m_argFrames[impl.m_argDepth++];
+    }
+    ~ArgScope() {
+      frame->values.clear();
+      --m_impl.m_argDepth;
+    }
+    ArgFrame* frame;
+  private:
+    Impl& m_impl;
+  };
+  struct ProfileItem {
+    size_t hits = 0;
+    uint64_t ns = 0;
   };
-  map<string, Interpreter::UserFunction> m_ufunc;
-  map<string, pair<Interpreter::UserOperator, uint32_t>> m_uoper; // operator, priority
-  map<string, string> m_var;
-  map<string, string> m_macro;
+  struct Profiler {  // tree of calls for folded stacks
+    struct Node {
+      string name;
+      size_t parent;
+      uint64_t selfNs;
+      map<pair<const Impl*, size_t>, size_t> childs;  // impl of script, index of entity -> node
+    };
+    struct Active {
+      size_t node;
+      chrono::steady_clock::time_point begin;
+      uint64_t childNs;
+    };
+    vector<Node> nodes{ Node{ "script", 0, 0, {} } };
+    vector<Active> active;
+  };
+  class ProfileScope {  // time of entity while the object lives, nothing when the profiler is off
+  public:
+    ProfileScope(Impl& impl, size_t iExpr, bool on = true) :
+      m_impl(on && impl.m_profiling ? &impl : nullptr), m_iExpr(iExpr) {
+      if (m_impl) m_impl->profileEnter(m_iExpr);
+    }
+    ~ProfileScope() {
+      if (m_impl) m_impl->profileLeave(m_iExpr);
+    }
+  private:
+    Impl* m_impl;
+    size_t m_iExpr;
+  };
+  class ContextScope {  // the reflection calls of interpreter go to the context while the object lives
+  public:
+    explicit ContextScope(Impl* ctx) : m_prev(runningContext()) { runningContext() = ctx; }
+    ~ContextScope() { runningContext() = m_prev; }
+  private:
+    Impl* m_prev;
+  };
+  struct RunControl {  // limits of run, the called script functions use the one of caller
+    size_t stepLimit = 0, timeoutMs = 0;  // 0 - no limit
+    size_t steps = 0;
+    chrono::steady_clock::time_point deadline;
+    atomic<bool> cancel{ false };
+    Interpreter::RunStatus status = Interpreter::RunStatus::OK;
+    Profiler* profiler = nullptr;  // nullptr - off
+
+    RunControl() = default;
+    RunControl(const RunControl& other) : stepLimit(other.stepLimit), timeoutMs(other.timeoutMs) {}
+    RunControl& operator=(const RunControl& other) {
+      stepLimit = other.stepLimit;
+      timeoutMs = other.timeoutMs;
+      return *this;
+    }
+  };
+  struct SubEvaluator {  // evaluation of script on the state of interpreter
+    shared_ptr<Impl> impl;
+    size_t version = 0, varCount = 0;  // of registries and variables of interpreter, the impl is made again on change
+  };
+  struct SubEvaluators {  // by depth of nested evaluations, are not copied with interpreter
+    deque<SubEvaluator> items;
+    size_t depth = 0;
+    SubEvaluators() = default;
+    SubEvaluators(const SubEvaluators&) {}
+    SubEvaluators& operator=(const SubEvaluators&) {
+      items.clear();
+      depth = 0;
+      return *this;
+    }
+  };
+  struct ScriptCache {
+    vector<ParsedScript> items;
+    unordered_map<size_t, size_t> index;  // hash of script, index of item
+    size_t capacity = 16, hits = 0, misses = 0, useCount = 0;
+  };
+  shared_ptr<const Registry> m_reg = make_shared<Registry>();  // is copied on change, if it is shared
+  deque<Value> m_var;           // value by slot, deque - operands bound to operator stay valid when a variable is added
+  map<string, size_t> m_varSlot; // vname, slot
+  unordered_map<string, MacroExpansion> m_macroExpansion;  // "#name(args)", expanded body
+  vector<string> m_macroUse;    // macros expanded in the parsed script
+  size_t m_macroExpandedSize = 0;
   map<string, size_t> m_label;
-  set<string> m_attribute;
   map<size_t, vector<string>> m_exprAttribute;
-  map<size_t, vector<Operatr>> m_soper;
-  map<string, Impl> m_internFunc;
+  vector<vector<Operatr>> m_postfix;  // order of operators of expressions
+  map<size_t, string> m_varType;  // type of variable by slot, declared in the parsed script
+  vector<IntKernel> m_intKernel;
+  map<string, shared_ptr<Impl>> m_internFunc;  // nullptr - resolved on call (recursion)
+  NameTrie m_internFuncNames;
+  ScriptCache m_cache;
+  ParseEffects m_parseEffects;
+  SubEvaluators m_subEval;
+  size_t m_registryVersion = 0;  // is changed with functions, operators, macros and attributes
   vector<Expression> m_expr;
+  vector<Value> m_exprResult;  // result of entity by index
+  vector<Instruction> m_code;
+  vector<Value> m_const;
+  vector<size_t> m_exprPc;  // pc of statement by index of entity
+  vector<Value> m_stack;
+  vector<Block> m_blocks;
+  deque<ArgFrame> m_argFrames;  // by depth of calls, deque - frames are not moved by a nested call
+  size_t m_argDepth = 0;
   string m_err, m_prevScript;
+  vector<size_t> m_srcPos;  // position in source script by position in cleaned script
+  string_view m_parseText;  // script while it is parsed, the parts of it are parsed without copies
+  vector<size_t> m_bracketEnd;  // position of closing bracket by position of opening one in m_parseText
+  Value m_result;
+  string m_blockResult;
   size_t m_gotoIndex = size_t(-1);
   size_t m_currentIndex = 0;
   bool m_exit = false;
-
-  string calcOperation(Keyword mainKeyword, size_t iExpr);
-  string calcFunction(size_t iExpr);
+  bool m_bytecode = true;
+  bool m_optimize = false;
+
+  Uid m_uid;
+  string m_funcName;           // name of script function
+  const Impl* m_declarer = nullptr;  // parser of the declaration while the body is parsed
+  vector<pair<size_t, size_t>> m_argSlot;  // index of argument, slot
+  vector<pair<size_t, size_t>> m_sharedSlot;  // slot of caller, slot of function, variables shared with the last caller
+  size_t m_sharedCaller = 0, m_sharedCallerVars = 0;  // uid and count of variables of the last caller
+  Impl* m_caller = nullptr;    // caller of script function while it runs
+  vector<Frame> m_frames;      // outer calls of script function on recursion
+  size_t m_activeCalls = 0;
+  size_t m_callDepth = 0;
+  size_t m_maxCallDepth = 1000;
+
+  RunControl m_control;
+  RunControl* m_pControl = nullptr;  // control of caller run, nullptr - own
+
+  bool m_profiling = false;  // the called script functions take it from caller
+  Profiler m_profiler;
+  vector<ProfileItem> m_profileItem;  // by index of entity
+
+  shared_ptr<const Impl> m_program;  // compiled script of execution context, nullptr - own program
+  const Impl* m_owner = nullptr;     // interpreter which compiled the script of execution context, is not dereferenced
+  const Impl& program() const { return m_program ? *m_program : *this; }
+  static Impl*& runningContext();
+  shared_ptr<Impl> copyWithoutCache();
+  void resetContext();
+  RunControl& control() { return m_pControl ? *m_pControl : m_control; }
+  bool countStep();
+  bool checkRunLimits(RunControl& ctl);
+  void profileEnter(size_t iExpr);
+  void profileLeave(size_t iExpr);
+  void resetProfile();
+
+  Value walkScript();
+  Value calcOperation(Keyword mainKeyword, size_t iExpr);
+  Value calcFunction(size_t iExpr);
   string calcCondition(size_t iExpr);
-  string calcExpression(size_t iBegin, size_t iEnd);
-  void calcOperatorPriority(size_t iBegin, size_t iEnd, vector<Operatr>& oprs);
-
-  bool parseInstructionScript(string& script, size_t gpos);
-  bool parseExpressionScript(string& script, size_t gpos);
-  bool parseArgumentScript(string& script, size_t gpos);
-  bool parseMacroArgs(const string& args, string& macro);
-
-  void cleaningScript(string& script) const;
+  Value calcExpression(size_t iBegin, size_t iEnd);
+  void calcPostfix(size_t iBegin, size_t iEnd, vector<Operatr>& oprs);
+  Value callFunction(size_t iExpr, ArgFrame& af);
+  Value callUserFunction(const Impl& prog, const string& fname, ArgFrame& af);
+  Impl* internFunction(const string& fname);
+  bool isInternFunction(const string& fname) const;
+  void resolveArguments();
+  const vector<pair<size_t, size_t>>& sharedSlots(const Impl& caller);
+  void pushFrame();
+  void popFrame();
+  void cloneInternFunctions(map<const Impl*, shared_ptr<Impl>>& clones);
+  Value callOperator(size_t iExpr, Value& ioLValue, Value& ioRValue);
+  bool isPlainOperand(size_t iOpd, size_t iRes) const;
+  const Value& entityResult(size_t iExpr) const;
+  bool isBinding(size_t iExpr) const;
+  void beginBinding(Value container, Binding& ioBind);
+  Value nextBinding(size_t iExpr, Binding& ioBind);
+  size_t variableSlot(const string& vname);
+
+  void compileScript();
+  void compileInstruction(size_t iBegin, size_t iEnd);
+  void compileExpression(size_t iBegin, size_t iEnd);
+  void compileOperation(size_t iExpr);
+  void compileFunction(size_t iExpr);
+  size_t compileOperand(size_t iOpd, size_t iRes, const vector<Operatr>& oprs, bool bind, bool isMutable);
+  bool declareTypes();
+  bool staticType(size_t iOpd, size_t iRes, Interpreter::ValueType& outType) const;
+  bool isIntOperand(size_t iOpd, size_t iRes, const vector<bool>& intResult) const;
+  void checkOperandTypes(const Operatr& op, const UserOperator& uopr);
+  Value callIntKernel(const IntKernel& kernel, size_t iExpr, Value& ioLValue, Value& ioRValue);
+  void emit(OpCode opc, size_t iExpr, size_t a = 0, size_t b = 0, uint32_t c = 0);
+  void emitValue(size_t iExpr);
+  Value runBytecode();
+  void leaveBlock();
+  bool jumpOnStatementEnd(size_t& pc);
+
+  void optimizeScript();
+  size_t optimizeInstruction(size_t iBegin, size_t iEnd);
+  size_t pruneCondition(size_t iExpr, size_t iEnd);
+  void foldStatement(size_t iBegin, size_t iEnd);
+  bool foldExpression(size_t iBegin, size_t iEnd, Value& outValue, vector<Folding>& folds);
+  bool foldOperand(size_t iOpd, Value& outValue, vector<Folding>& folds);
+  void applyFoldings(vector<Folding>& folds);
+  void eraseEntities(size_t iBegin, size_t iEnd);
+
+  bool loadParsedScript(const string& script);
+  void storeParsedScript(const string& script);
+  void clearScriptCache();
+  void dropMacroUses(const string& mname);
+  shared_ptr<Impl> makeSubEvaluator() const;
+  void resetResults();
+  Registry& registry();
+  void setMacroScript(const string& mname, const string& script);
+  void setInternFunction(const string& fname, const shared_ptr<Impl>& fImpl);
+
+  bool parseInstructionScript(string_view script, size_t gpos);
+  bool parseExpressionScript(string_view script, size_t gpos);
+  bool parseArgumentScript(string_view script, size_t gpos);
+  bool parseIndexScript(string_view index, size_t gpos);
+  Macro compileMacro(const string& body) const;
+  vector<string> splitMacroArgs(const string& args) const;
+  bool expandMacros(string& script, vector<size_t>& ioSrcPos);
+  bool expandMacroScript(const string& script, size_t depth, size_t usePos, string& outScript, const vector<size_t>* srcPos, vector<size_t>* outSrcPos);
+
+  void cleaningScript(string& script, vector<size_t>& outSrcPos) const;
+  size_t sourcePosition(size_t pos) const;
   bool checkScript(const string& script, string& err) const;
+  void matchBrackets(const string& script);
+  bool isParsedText(string_view script) const;
+  size_t closingBracket(string_view script, size_t pos, char symbBegin, char symbEnd) const;
 
-  bool startWith(const string& str, size_t pos, const string& begin) const;
+  bool startWith(string_view str, size_t pos, const string& begin) const;
   bool isNumber(const string& s) const;
+  bool isArgument(const string& vname) const;
+  bool isTrue(const string& condn) const;
+  bool isTrue(const Value& condn) const;
   bool isFindKeySymbol(const string& script, size_t cpos, size_t maxpos) const;
-  Keyword keywordByName(const string& oprName) const;
+  Keyword keywordByName(string_view oprName) const;
   Interpreter::EntityType keywordToEntityType(Keyword keyw) const;
-  string getNextParam(const string& script, size_t& cpos, char symb) const;
-  string getOperatorAtFirst(const string& script, size_t& cpos) const;
-  string getFunctionAtFirst(const string& script, size_t& cpos) const;
-  string getMacroAtFirst(const string& script, size_t& cpos) const;
-  string getAttributeAtFirst(const string& script, size_t& cpos) const;
-  string getNextOperator(const string& script, size_t& cpos) const;
-  string getIntroScript(const string& script, size_t& cpos, char symbBegin, char symbEnd) const;
+  string_view getNextParam(string_view script, size_t& cpos, char symb) const;
+  string getOperatorAtFirst(string_view script, size_t& cpos) const;
+  string getFunctionAtFirst(string_view script, size_t& cpos) const;
+  string getMacroAtFirst(string_view script, size_t& cpos) const;
+  string getAttributeAtFirst(string_view script, size_t& cpos) const;
+  string getNextOperator(string_view script, size_t& cpos) const;
+  string_view getIntroScript(string_view script, size_t& cpos, char symbBegin, char symbEnd) const;
 };
 
+class Interpreter::CompiledScript {
+public:
+  shared_ptr<const Impl> program;  // is not changed after parsing
+};
+
+Interpreter::Impl::Impl(shared_ptr<const Impl> program) :
+  m_program(move(program)) {
+
+  m_owner = m_program->m_owner;
+  m_var = m_program->m_var;
+  m_exprResult = m_program->m_exprResult;
+  m_internFunc = m_program->m_internFunc;
+  m_maxCallDepth = m_program->m_maxCallDepth;
+  m_control = m_program->m_control;
+  cloneInternFunctions();  // a call of function changes its state
+}
+shared_ptr<const Interpreter::Impl> Interpreter::Impl::sharedProgram(string script, string& err) {
+
+  if (!parseScript(move(script), err))
+    return nullptr;
+
+  auto prog = copyWithoutCache();
+  prog->m_owner = this;
+  prog->m_prevScript.clear();
+  prog->resetResults();
+  prog->cloneInternFunctions();
+  return prog;
+}
+Interpreter::Impl*& Interpreter::Impl::runningContext() {
+  thread_local Impl* ctx = nullptr;  // execution context, which runs in the thread
+  return ctx;
+}
+Interpreter::Impl* Interpreter::Impl::current(Impl* owner) {
+  // the user functions of interpreter are called from the contexts of its compiled scripts
+  Impl* ctx = runningContext();
+  return ctx && owner && (ctx->m_owner == owner) ? ctx : owner;
+}
+void Interpreter::Impl::resetContext() {
+  m_var = m_program->m_var;
+  m_exprResult = m_program->m_exprResult;
+}
+vector<string> Interpreter::Impl::runBatch(const string& script, const vector<map<string, string>>& inputs, size_t threads, Interpreter::BatchStat* outStat) {
+
+  const auto tmBegin = chrono::steady_clock::now();
+
+  string err;
+  auto prog = sharedProgram(script, err);
+  if (!prog)
+    return vector<string>(inputs.size(), err);
+
+  if (threads == 0)
+    threads = max<size_t>(thread::hardware_concurrency(), 1);
+  threads = max<size_t>(min(threads, inputs.size()), 1);
+
+  // every thread takes inputs from the begin of own range,
+  // an idle thread takes the second half of the biggest range of another one
+  struct Range {
+    mutex mtx;
+    size_t begin = 0, end = 0;
+  };
+  vector<Range> ranges(threads);
+  for (size_t i = 0; i < threads; ++i) {
+    ranges[i].begin = inputs.size() * i / threads;
+    ranges[i].end = inputs.size() * (i + 1) / threads;
+  }
+  vector<string> results(inputs.size());
+  vector<size_t> runs(threads, 0), steals(threads, 0);
+  mutex errMtx;
+  exception_ptr error;
+
+  auto worker = [&](size_t iThr) {
+    Impl ctx(prog);
+    Range& own = ranges[iThr];
+    while (true) {
+      size_t i = size_t(-1);
+      {
+        lock_guard<mutex> lock(own.mtx);
+        if (own.begin < own.end)
+          i = own.begin++;
+      }
+      if (i == size_t(-1)) {
+        size_t iVictim = threads, maxSize = 1;
+        for (size_t j = 0; j < threads; ++j) {
+          lock_guard<mutex> lock(ranges[j].mtx);
+          if (ranges[j].end - ranges[j].begin > maxSize) {
+            maxSize = ranges[j].end - ranges[j].begin;
+            iVictim = j;
+          }
+        }
+        if (iVictim == threads) break;
+        size_t begin = 0, end = 0;
+        {
+          lock_guard<mutex> lock(ranges[iVictim].mtx);
+          Range& victim = ranges[iVictim];
+          if (victim.end - victim.begin < 2) continue;
+          begin = victim.begin + (victim.end - victim.begin) / 2;
+          end = victim.end;
+          victim.end = begin;
+        }
+        lock_guard<mutex> lock(own.mtx);
+        own.begin = begin;
+        own.end = end;
+        ++steals[iThr];
+        continue;
+      }
+      try {
+        ctx.resetContext();
+        for (const auto& var : inputs[i])
+          ctx.setVariable(var.first, var.second);
+        results[i] = ctx.runScript();
+        ++runs[iThr];
+      }
+      catch (...) {
+        lock_guard<mutex> lock(errMtx);
+        if (!error) error = current_exception();
+      }
+    }
+  };
+  vector<thread> pool;
+  for (size_t i = 1; i < threads; ++i)
+    pool.emplace_back(worker, i);
+  worker(0);
+  for (auto& t : pool)
+    t.join();
+
+  if (error)
+    rethrow_exception(error);
+
+  if (outStat) {
+    outStat->threads = threads;
+    outStat->runsByThread = runs;
+    outStat->steals = 0;
+    for (size_t st : steals)
+      outStat->steals += st;
+    outStat->seconds = chrono::duration<double>(chrono::steady_clock::now() - tmBegin).count();
+    outStat->runsPerSecond = outStat->seconds > 0 ? double(inputs.size()) / outStat->seconds : 0;
+  }
+  return results;
+}
+shared_ptr<Interpreter::Impl> Interpreter::Impl::copyWithoutCache() {
+  ScriptCache cache;
+  swap(cache, m_cache);
+  auto impl = make_shared<Impl>(*this);
+  swap(cache, m_cache);
+  impl->m_cache.capacity = 0;
+  impl->m_caller = nullptr;
+  impl->m_frames.clear();
+  impl->m_activeCalls = impl->m_callDepth = 0;
+  impl->m_pControl = nullptr;
+  return impl;
+}
+
 string Interpreter::Impl::cmd(string script) {
     
   string err;
@@ -137,7 +702,8 @@ string Interpreter::Impl::cmd(string script) {
 
 bool Interpreter::Impl::parseScript(string script, string& err) {
 
-  cleaningScript(script);
+  vector<size_t> srcPos;
+  cleaningScript(script, srcPos);
 
   if (script.empty()) {
     err = "Error: empty script";
@@ -146,27 +712,313 @@ bool Interpreter::Impl::parseScript(string script, string& err) {
 
   if (script.back() != ';') script += ';';
 
-  if (m_prevScript != script) {
+  if (m_prevScript == script) {
+    ++m_cache.hits;
+  }
+  else if (loadParsedScript(script)) {
+    m_prevScript = script;
+  }
+  else {
     m_prevScript = script;
     m_expr.clear();
     m_label.clear();
-    m_soper.clear();
+    m_postfix.clear();
+    m_varType.clear();
+    m_exprAttribute.clear();
+    m_code.clear();
     m_err.clear();
-    if (!checkScript(script, m_err) || !parseInstructionScript(script, 0)) {
+    m_parseEffects = ParseEffects();
+    m_macroUse.clear();
+    m_srcPos = move(srcPos);
+    bool ok = checkScript(script, m_err) && expandMacros(script, m_srcPos);
+    if (ok) {
+      matchBrackets(script);
+      ok = parseInstructionScript(script, 0);
+      m_parseText = string_view();
+      ok = ok && declareTypes();
+    }
+    if (ok) {
+      if (m_optimize)
+        optimizeScript();
+      compileScript();  // the types of operands are checked here
+      ok = m_err.empty();
+    }
+    if (!ok) {
+      m_code.clear();
+      resetResults();
       m_prevScript.clear();
       err = m_err;
       return false;
     }
+    resetResults();
+    resetProfile();
+    storeParsedScript(script);
+  }
+  return true;
+}
+
+bool Interpreter::Impl::loadParsedScript(const string& script) {
+
+  auto it = m_cache.index.find(hash<string>()(script));
+  if ((it == m_cache.index.end()) || (m_cache.items[it->second].script != script)) {
+    ++m_cache.misses;
+    return false;
   }
+  ++m_cache.hits;
+  ParsedScript& ps = m_cache.items[it->second];
+  ps.lastUse = ++m_cache.useCount;
+  m_expr = ps.expr;
+  m_label = ps.label;
+  m_exprAttribute = ps.exprAttribute;
+  m_code = ps.code;
+  m_const = ps.constant;
+  m_exprPc = ps.exprPc;
+  m_postfix = ps.postfix;
+  m_varType = ps.varType;
+  m_intKernel = ps.intKernel;
+  m_macroExpandedSize = ps.expandedSize;
+  m_macroUse = ps.macroUse;
+  resetResults();
+  resetProfile();
+
+  ParseEffects effects = ps.effects;  // the cache may be cleared below
+  for (const auto& var : effects.varInit)
+    m_var[var.first] = var.second;
+  for (const auto& macro : effects.macro)
+    setMacroScript(macro.first, macro.second);
+  for (const auto& func : effects.internFunc)
+    setInternFunction(func.first, make_shared<Impl>(*func.second));
   return true;
 }
+void Interpreter::Impl::storeParsedScript(const string& script) {
+
+  if (m_cache.capacity == 0) return;
+
+  size_t hash = std::hash<string>()(script);
+  auto it = m_cache.index.find(hash);
+  size_t pos = m_cache.items.size();
+  if (it != m_cache.index.end()) {  // collision
+    pos = it->second;
+  }
+  else if (m_cache.items.size() >= m_cache.capacity) {  // drop least recently used
+    pos = 0;
+    for (size_t i = 1; i < m_cache.items.size(); ++i) {
+      if (m_cache.items[i].lastUse < m_cache.items[pos].lastUse)
+        pos = i;
+    }
+    m_cache.index.erase(std::hash<string>()(m_cache.items[pos].script));
+  }
+  if (pos == m_cache.items.size())
+    m_cache.items.emplace_back();
+
+  vector<string> macroUse = m_macroUse;
+  sort(macroUse.begin(), macroUse.end());
+  macroUse.erase(unique(macroUse.begin(), macroUse.end()), macroUse.end());
+
+  ParsedScript& ps = m_cache.items[pos];
+  ps = ParsedScript{ script, ++m_cache.useCount, m_expr, m_label, m_exprAttribute, m_postfix, m_varType, m_intKernel, m_code, m_const, m_exprPc, m_macroExpandedSize, m_parseEffects, move(macroUse) };
+  m_cache.index[hash] = pos;
+}
+void Interpreter::Impl::profileEnter(size_t iExpr) {
+
+  Profiler* prof = control().profiler;
+  if (!prof) return;
+
+  size_t parent = prof->active.empty() ? 0 : prof->active.back().node;
+  auto key = make_pair(static_cast<const Impl*>(this), iExpr);
+  auto it = prof->nodes[parent].childs.find(key);
+  size_t node = 0;
+  if (it == prof->nodes[parent].childs.end()) {
+    const Expression& ex = program().m_expr[iExpr];
+    node = prof->nodes.size();
+    prof->nodes[parent].childs.emplace(key, node);
+    prof->nodes.push_back(Profiler::Node{ (ex.keyw == Keyword::WHILE ? "while" : ex.params) + "@" + to_string(iExpr), parent, 0, {} });
+  }
+  else node = it->second;
+
+  prof->active.push_back(Profiler::Active{ node, chrono::steady_clock::now(), 0 });
+}
+void Interpreter::Impl::profileLeave(size_t iExpr) {
+
+  Profiler* prof = control().profiler;
+  if (!prof || prof->active.empty()) return;
+
+  Profiler::Active act = prof->active.back();
+  prof->active.pop_back();
+  uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - act.begin).count();
+  prof->nodes[act.node].selfNs += ns - min(ns, act.childNs);
+  if (!prof->active.empty())
+    prof->active.back().childNs += ns;
+
+  if (m_profileItem.size() <= iExpr)
+    m_profileItem.resize(program().m_expr.size());
+  ++m_profileItem[iExpr].hits;
+  m_profileItem[iExpr].ns += ns;
+}
+void Interpreter::Impl::resetProfile() {
+  m_profileItem.assign(m_expr.size(), ProfileItem());
+  m_profiler = Profiler();
+}
+void Interpreter::Impl::resetResults() {
+  m_exprResult.resize(m_expr.size());
+  for (size_t i = 0; i < m_expr.size(); ++i)
+    m_exprResult[i] = m_expr[i].value;
+}
+void Interpreter::Impl::clearScriptCache() {
+  m_cache.items.clear();
+  m_cache.index.clear();
+  m_prevScript.clear();
+  ++m_registryVersion;  // the parsed state depends on registries
+}
+void Interpreter::Impl::dropMacroUses(const string& mname) {
+  // the uses of the shorter names are dropped too, the longest name is matched now
+  auto isUsed = [&mname](const vector<string>& macroUse) {
+    return any_of(macroUse.begin(), macroUse.end(), [&mname](const string& m) { return mname.compare(0, m.size(), m) == 0; });
+  };
+  for (auto it = m_macroExpansion.begin(); it != m_macroExpansion.end();) {
+    if (isUsed(it->second.macroUse)) it = m_macroExpansion.erase(it);
+    else ++it;
+  }
+  auto& items = m_cache.items;
+  items.erase(remove_if(items.begin(), items.end(), [&isUsed](const ParsedScript& ps) { return isUsed(ps.macroUse); }), items.end());
+  m_cache.index.clear();
+  for (size_t i = 0; i < items.size(); ++i)
+    m_cache.index[hash<string>()(items[i].script)] = i;
+  if (isUsed(m_macroUse))
+    m_prevScript.clear();
+  ++m_registryVersion;  // the sub-evaluators take the new registry
+}
+Interpreter::Impl::Registry& Interpreter::Impl::registry() {
+  if (m_reg.use_count() > 1)  // shared with script functions or copies of interpreter
+    m_reg = make_shared<Registry>(*m_reg);
+  return const_cast<Registry&>(*m_reg);
+}
+void Interpreter::Impl::setMacroScript(const string& mname, const string& script) {
+  auto it = m_reg->macro.find(mname);
+  if ((it == m_reg->macro.end()) || (it->second.body != script)) {
+    Registry& reg = registry();
+    reg.macro[mname] = compileMacro(script);
+    reg.macroNames.insert(mname);
+    dropMacroUses(mname);  // only the expansions and parsed scripts with the previous macro
+  }
+}
+void Interpreter::Impl::setInternFunction(const string& fname, const shared_ptr<Impl>& fImpl) {
+  if (!m_internFunc.count(fname)) {
+    m_internFuncNames.insert(fname);
+    clearScriptCache();   // parsed scripts could use the name as a variable or value
+  }
+  m_internFunc[fname] = fImpl;
+  ++m_registryVersion;
+}
 
 string Interpreter::Impl::runScript() {
 
-  for (auto& ex : m_expr)
-    ex.iOperator = size_t(-1);
+  const bool isOwnRun = !m_pControl;
+  if (isOwnRun) {
+    m_control.steps = 0;
+    m_control.status = Interpreter::RunStatus::OK;
+    if (m_control.cancel.load(memory_order_relaxed))  // sent before the run, is cleared when the run ends
+      m_control.status = Interpreter::RunStatus::CANCELLED;
+    if (m_control.timeoutMs > 0)
+      m_control.deadline = chrono::steady_clock::now() + chrono::milliseconds(m_control.timeoutMs);
+    m_control.profiler = m_profiling ? &m_profiler : nullptr;
+    m_profiler.active.clear();  // may remain after exception
+  }
+  ContextScope cs(isOwnRun ? (m_owner ? this : nullptr) : runningContext());
+
+  Value result;
+  try {
+    if (!isOwnRun || (m_control.status == Interpreter::RunStatus::OK))
+      result = (m_bytecode || m_program) ? runBytecode() : walkScript();  // the walk is on own entities, not of program
+  }
+  catch (...) {
+    if (isOwnRun)
+      m_control.cancel = false;
+    throw;
+  }
+  if (isOwnRun) {
+    m_control.cancel = false;
+    switch (m_control.status) {
+    case Interpreter::RunStatus::STEP_LIMIT: return "Error: step limit";
+    case Interpreter::RunStatus::TIMEOUT: return "Error: timeout";
+    case Interpreter::RunStatus::CANCELLED: return "Error: cancelled";
+    default: break;
+    }
+  }
+  return result.release();
+}
+bool Interpreter::Impl::evalScript(const string& script, string& outResult, string& outErr) {
+
+  if (m_subEval.depth == m_subEval.items.size())
+    m_subEval.items.emplace_back();
+  SubEvaluator& se = m_subEval.items[m_subEval.depth];
+  if (!se.impl || (se.version != m_registryVersion) || (se.varCount != m_var.size())) {
+    se.impl = makeSubEvaluator();
+    se.version = m_registryVersion;
+    se.varCount = m_var.size();
+  }
+  Impl& sub = *se.impl;
+  copy(m_var.begin(), m_var.end(), sub.m_var.begin());  // the slots of variables are the same
+  fill(sub.m_var.begin() + se.varCount, sub.m_var.end(), Value());
+
+  ++m_subEval.depth;
+  sub.m_pControl = &control();  // the steps and cancel of the run which evaluates
+  bool ok = false;
+  try {
+    ok = sub.parseScript(script, outErr);
+    if (ok)
+      outResult = sub.runScript();
+  }
+  catch (...) {
+    sub.m_pControl = nullptr;
+    --m_subEval.depth;
+    throw;
+  }
+  sub.m_pControl = nullptr;
+  --m_subEval.depth;
+  if (control().status != Interpreter::RunStatus::OK)
+    m_exit = true;
+  return ok;
+}
+shared_ptr<Interpreter::Impl> Interpreter::Impl::makeSubEvaluator() const {
+
+  // registries without parsed state, script functions are shared
+  auto sub = make_shared<Impl>();
+  sub->m_reg = m_reg;
+  sub->m_internFunc = m_internFunc;
+  sub->m_internFuncNames = m_internFuncNames;
+  sub->m_varSlot = program().m_varSlot;
+  sub->m_var.resize(m_var.size());
+  sub->m_bytecode = m_bytecode;
+  sub->m_optimize = m_optimize;
+  sub->m_maxCallDepth = m_maxCallDepth;
+  return sub;
+}
+bool Interpreter::Impl::countStep() {
+
+  RunControl& ctl = control();
+  ++ctl.steps;
+  if ((ctl.steps & 255) && ((ctl.stepLimit == 0) || (ctl.steps <= ctl.stepLimit)))
+    return false;
+  return checkRunLimits(ctl);
+}
+bool Interpreter::Impl::checkRunLimits(RunControl& ctl) {
+
+  if (ctl.status == Interpreter::RunStatus::OK) {
+    if ((ctl.stepLimit > 0) && (ctl.steps > ctl.stepLimit))
+      ctl.status = Interpreter::RunStatus::STEP_LIMIT;
+    else if (ctl.cancel.load(memory_order_relaxed))
+      ctl.status = Interpreter::RunStatus::CANCELLED;
+    else if ((ctl.timeoutMs > 0) && (chrono::steady_clock::now() >= ctl.deadline))
+      ctl.status = Interpreter::RunStatus::TIMEOUT;
+  }
+  if (ctl.status != Interpreter::RunStatus::OK)
+    m_exit = true;
+  return m_exit;
+}
+Interpreter::Impl::Value Interpreter::Impl::walkScript() {
 
-  string result;
+  Value result;
   m_exit = false;
   for (size_t i = 0; i < m_expr.size();) {
 
@@ -174,8 +1026,6 @@ string Interpreter::Impl::runScript() {
     i = max(m_expr[i].iConditionEnd, m_expr[i].iBodyEnd);
 
     if (m_gotoIndex != size_t(-1)) {
-      for (size_t j = m_gotoIndex; j < i; ++j)
-        m_expr[j].iOperator = size_t(-1);
       i = m_gotoIndex;
       m_gotoIndex = size_t(-1);
     }
@@ -184,53 +1034,83 @@ string Interpreter::Impl::runScript() {
   return result;
 }
 
-void Interpreter::Impl::cleaningScript(string& script) const {
+void Interpreter::Impl::cleaningScript(string& script, vector<size_t>& outSrcPos) const {
 
-  // del comments
-  size_t commp = script.find("//");
-  while (commp != string::npos) {
-    size_t endStr = script.find("\n", commp);
-    if (endStr != string::npos){
-      script.erase(commp, endStr - commp + 1);
-      commp = script.find("//", endStr);
-    }else{
-      script.erase(commp);
-      break;
+  // one pass: del comments and spaces, keep string "value" as is
+  string res;
+  res.reserve(script.size());
+  outSrcPos.clear();
+  outSrcPos.reserve(script.size());
+
+  const size_t ssz = script.size();
+  for (size_t i = 0; i < ssz; ++i) {
+    const char c = script[i];
+    if ((c == '/') && (i + 1 < ssz) && (script[i + 1] == '/')) {
+      i = script.find('\n', i);
+      if (i == string::npos) break;
+      continue;
     }
-  }
-
-  // save string "value"
-  vector<string> strVals;
-  size_t beginStr = script.find("\"");
-  while (beginStr != string::npos) {
-    size_t endStr = script.find("\"", beginStr + 1);
-    if (endStr != string::npos) {
-      strVals.emplace_back(script.substr(beginStr, endStr - beginStr + 1));
-      beginStr = script.find("\"", endStr + 1);
+    if (c == '"') {
+      size_t endStr = script.find('"', i + 1);
+      if (endStr != string::npos) {
+        for (; i < endStr; ++i) {
+          res += script[i];
+          outSrcPos.push_back(i);
+        }
+      }
     }
-    else break;
+    else if ((c == ' ') || (c == '\n') || (c == '\t') || (c == '\v') || (c == '\f') || (c == '\r')) {
+      continue;
+    }
+    res += script[i];
+    outSrcPos.push_back(i);
   }
-
-  // cleaning
-  script.erase(remove(script.begin(), script.end(), '\n'), script.end());
-  script.erase(remove(script.begin(), script.end(), '\t'), script.end());
-  script.erase(remove(script.begin(), script.end(), '\v'), script.end());
-  script.erase(remove(script.begin(), script.end(), '\f'), script.end());
-  script.erase(remove(script.begin(), script.end(), '\r'), script.end());
-  script.erase(remove(script.begin(), script.end(), ' '), script.end());
-
-  // restore string "value"
-  beginStr = script.find("\"");
-  size_t iVal = 0;
-  while ((beginStr != string::npos) && (iVal < strVals.size())) {
-    size_t endStr = script.find("\"", beginStr + 1);
-    if (endStr != string::npos) {
-      script.replace(beginStr, endStr - beginStr + 1, strVals[iVal]);
-      beginStr = script.find("\"", beginStr + strVals[iVal].size() + 1);
-      ++iVal;
+  script = move(res);
+}
+void Interpreter::Impl::matchBrackets(const string& script) {
+
+  // one pass: the pairs of brackets of every kind, as getIntroScript counts them
+  m_parseText = script;
+  m_bracketEnd.assign(script.size(), string::npos);
+  vector<size_t> open[3];  // (, {, [
+  for (size_t i = 0; i < script.size(); ++i) {
+    switch (script[i]) {
+    case '(': open[0].push_back(i); break;
+    case '{': open[1].push_back(i); break;
+    case '[': open[2].push_back(i); break;
+    case ')': case '}': case ']': {
+      vector<size_t>& kind = open[script[i] == ')' ? 0 : (script[i] == '}' ? 1 : 2)];
+      if (!kind.empty()) {
+        m_bracketEnd[kind.back()] = i;
+        kind.pop_back();
+      }
+      break;
     }
-    else break;
+    default: break;
+    }
+  }
+}
+bool Interpreter::Impl::isParsedText(string_view script) const {
+  const less_equal<const char*> le;
+  return !m_parseText.empty() && le(m_parseText.data(), script.data()) &&
+    le(script.data() + script.size(), m_parseText.data() + m_parseText.size());
+}
+size_t Interpreter::Impl::closingBracket(string_view script, size_t pos, char symbBegin, char symbEnd) const {
+  if ((pos < script.size()) && (script[pos] == symbBegin) && isParsedText(script)) {
+    const size_t offset = script.data() - m_parseText.data(),
+                 end = m_bracketEnd[offset + pos];
+    return (end != string::npos) && (end - offset < script.size()) ? end - offset : string::npos;
+  }
+  int bordCnt = 0;
+  for (size_t cp = pos; cp < script.size(); ++cp) {
+    if (script[cp] == symbBegin) ++bordCnt;
+    if (script[cp] == symbEnd) --bordCnt;
+    if (bordCnt == 0) return cp;
   }
+  return string::npos;
+}
+size_t Interpreter::Impl::sourcePosition(size_t pos) const {
+  return pos < m_srcPos.size() ? m_srcPos[pos] : pos;
 }
 
 bool Interpreter::Impl::checkScript(const string& script, string& err) const {
@@ -250,105 +1130,281 @@ bool Interpreter::Impl::checkScript(const string& script, string& err) const {
   return true;
 }
 
-bool Interpreter::Impl::addFunction(const string& name, Interpreter::UserFunction ufunc) {
+bool Interpreter::Impl::addFunction(const string& name, Interpreter::UserFunction ufunc, bool pure) {
+  if (name.empty() || (keywordByName(name) != Keyword::INSTRUCTION) || isFindKeySymbol(name, 0, name.size())) return false;
+  Registry& reg = registry();
+  reg.ufunc[name] = move(ufunc);
+  reg.ufuncView.erase(name);
+  reg.ufuncNames.insert(name);
+  if (pure) reg.pureFunc.insert(name);
+  else reg.pureFunc.erase(name);
+  clearScriptCache();
+  return true;
+}
+bool Interpreter::Impl::addFunctionView(const string& name, Interpreter::UserFunctionView ufunc, bool pure) {
   if (name.empty() || (keywordByName(name) != Keyword::INSTRUCTION) || isFindKeySymbol(name, 0, name.size())) return false;
-  m_ufunc[name] = move(ufunc);
+  Registry& reg = registry();
+  reg.ufuncView[name] = move(ufunc);
+  reg.ufunc.erase(name);
+  reg.ufuncNames.insert(name);
+  if (pure) reg.pureFunc.insert(name);
+  else reg.pureFunc.erase(name);
+  clearScriptCache();
   return true;
 }
-bool Interpreter::Impl::addOperator(const string& name, Interpreter::UserOperator uopr, uint32_t priority) {
+bool Interpreter::Impl::addOperator(const string& name, Interpreter::UserOperator uopr, uint32_t priority, bool pure,
+                                    Interpreter::OperandMutability mutability) {
   if (name.empty() || (keywordByName(name) != Keyword::INSTRUCTION) || isFindKeySymbol(name, 0, name.size())) return false;
-  m_uoper[name] = {move(uopr), priority};
+  using Mut = Interpreter::OperandMutability;
+  const bool lMutable = !pure && ((mutability == Mut::BOTH) || (mutability == Mut::LEFT)),
+             rMutable = !pure && ((mutability == Mut::BOTH) || (mutability == Mut::RIGHT));
+  Registry& reg = registry();
+  reg.uoper[name] = {move(uopr), priority, nullptr, nullptr, pure, lMutable, rMutable, nullptr};
+  reg.uoperNames.insert(name);
+  clearScriptCache();
+  return true;
+}
+bool Interpreter::Impl::addOperatorView(const string& name, Interpreter::UserOperatorView uopr, uint32_t priority, bool pure) {
+  if (!uopr || name.empty() || (keywordByName(name) != Keyword::INSTRUCTION) || isFindKeySymbol(name, 0, name.size())) return false;
+  auto func = [uopr](string& leftOpd, string& rightOpd) ->string {
+    return uopr(leftOpd, rightOpd);
+  };
+  Registry& reg = registry();
+  reg.uoper[name] = {move(func), priority, nullptr, nullptr, pure, false, false, move(uopr)};
+  reg.uoperNames.insert(name);
+  clearScriptCache();
+  return true;
+}
+bool Interpreter::Impl::addOperatorInt64(const string& name, Interpreter::UserOperatorInt64 uopr) {
+  if (!m_reg->uoper.count(name)) return false;
+  registry().uoper[name].intFunc = move(uopr);
+  clearScriptCache();  // the kernels are compiled into scripts and are called when parsing
+  return true;
+}
+bool Interpreter::Impl::addOperatorDouble(const string& name, Interpreter::UserOperatorDouble uopr) {
+  if (!m_reg->uoper.count(name)) return false;
+  registry().uoper[name].dblFunc = move(uopr);
+  clearScriptCache();
+  return true;
+}
+bool Interpreter::Impl::addIterable(Interpreter::UserIterable uiter) {
+  if (!uiter) return false;
+  registry().iterable.push_back(move(uiter));
+  ++m_registryVersion;
+  return true;
+}
+bool Interpreter::Impl::addType(const string& name, Interpreter::ValueType type) {
+  if (name.empty()) return false;
+  registry().type[name] = type;
+  clearScriptCache();
   return true;
 }
 bool Interpreter::Impl::addAttribute(const string& name) {
-  m_attribute.insert(name);
+  Registry& reg = registry();
+  reg.attribute.insert(name);
+  reg.attributeNames.insert(name);
+  clearScriptCache();
   return true;
 }
 
 std::map<std::string, std::string> Interpreter::Impl::allVariables() const {
-  return m_var;
+  std::map<std::string, std::string> res;
+  for (const auto& var : program().m_varSlot)
+    res.emplace_hint(res.end(), var.first, m_var[var.second].str());
+  return res;
 }
 std::string Interpreter::Impl::variable(const std::string& vname) const {
-  return m_var.find(vname) != m_var.end() ? m_var.at(vname) : "";
+  const Impl& prog = program();
+  auto it = prog.m_varSlot.find(vname);
+  return it != prog.m_varSlot.end() ? m_var[it->second].str() : "";
+}
+std::string Interpreter::Impl::variableType(const std::string& vname) const {
+  const Impl& prog = program();
+  auto it = prog.m_varSlot.find(vname);
+  if (it == prog.m_varSlot.end()) return "";
+  auto itType = prog.m_varType.find(it->second);
+  return itType != prog.m_varType.end() ? itType->second : "";
 }
 bool Interpreter::Impl::setVariable(const std::string& vname, const std::string& value) {
-  m_var[vname] = value;
+  if (m_program) {  // the slots of compiled script are fixed
+    auto it = m_program->m_varSlot.find(vname);
+    if (it == m_program->m_varSlot.end()) return false;
+    m_var[it->second] = value;
+    return true;
+  }
+  m_var[variableSlot(vname)] = value;
   return true;
 }
+size_t Interpreter::Impl::variableSlot(const std::string& vname) {
+  auto it = m_varSlot.find(vname);
+  if (it != m_varSlot.end())
+    return it->second;
+  m_varSlot.emplace(vname, m_var.size());
+  m_var.emplace_back();
+  return m_var.size() - 1;
+}
 std::string Interpreter::Impl::runFunction(const std::string& fname, const std::vector<std::string>& args) {
-  return m_ufunc.count(fname) ? m_ufunc[fname](args) : "";
+  ArgScope as(*this);
+  for (const auto& arg : args)
+    as.frame->values.emplace_back(arg);
+  return callUserFunction(*this, fname, *as.frame).release();
 }
 bool Interpreter::Impl::setMacro(const std::string& mname, const std::string& script) {
-  m_macro[mname] = script;
+  string body = script;
+  vector<size_t> srcPos;
+  cleaningScript(body, srcPos);
+  setMacroScript(mname, body);
   return true;
 }
 bool Interpreter::Impl::gotoOnLabel(const std::string& lname) {
-  bool exist = m_label.find(lname) != m_label.end();
-  if (exist)
-    m_gotoIndex = m_label[lname];
-  return exist;
+  const auto& label = program().m_label;
+  auto it = label.find(lname);
+  if (it != label.end())
+    m_gotoIndex = it->second;
+  return it != label.end();
 }
 void Interpreter::Impl::exitFromScript() {
   m_exit = true;
 }
 std::vector<Interpreter::Entity> Interpreter::Impl::allEntities() {
+  const auto& expr = program().m_expr;
   std::vector<Interpreter::Entity> res;
-  for (size_t i = 0; i < m_expr.size(); ++i) {    
-    const auto& exp = m_expr[i];
+  for (size_t i = 0; i < expr.size(); ++i) {
+    const auto& exp = expr[i];
     res.emplace_back(Interpreter::Entity{
-      i, exp.iConditionEnd, exp.iBodyEnd, keywordToEntityType(exp.keyw), exp.params, exp.result
+      i, exp.iConditionEnd, exp.iBodyEnd, keywordToEntityType(exp.keyw), exp.params, entityResult(i).str()
     });
   }
   return res;
 }
 Interpreter::Entity Interpreter::Impl::currentEntity() {
-  if (m_currentIndex >= m_expr.size())
+  const auto& expr = program().m_expr;
+  if (m_currentIndex >= expr.size())
     return Interpreter::Entity{0};
-  const auto& exp = m_expr[m_currentIndex];
+  const auto& exp = expr[m_currentIndex];
   return Interpreter::Entity{
-      m_currentIndex, exp.iConditionEnd, exp.iBodyEnd, keywordToEntityType(exp.keyw), exp.params, exp.result
+      m_currentIndex, exp.iConditionEnd, exp.iBodyEnd, keywordToEntityType(exp.keyw), exp.params, entityResult(m_currentIndex).str()
   };
 }
 Interpreter::Entity Interpreter::Impl::getEntityByIndex(size_t beginIndex) {
-  if (beginIndex >= m_expr.size())
+  const auto& expr = program().m_expr;
+  if (beginIndex >= expr.size())
     return Interpreter::Entity{ 0 };
-  const auto& exp = m_expr[beginIndex];
+  const auto& exp = expr[beginIndex];
   return Interpreter::Entity{
-      beginIndex, exp.iConditionEnd, exp.iBodyEnd, keywordToEntityType(exp.keyw), exp.params, exp.result
+      beginIndex, exp.iConditionEnd, exp.iBodyEnd, keywordToEntityType(exp.keyw), exp.params, entityResult(beginIndex).str()
   };
 }
+size_t Interpreter::Impl::currentIndex() const {
+  return m_currentIndex < program().m_expr.size() ? m_currentIndex : 0;
+}
+const string& Interpreter::Impl::getNameByIndex(size_t beginIndex) const {
+  static const string empty;
+  const auto& expr = program().m_expr;
+  return beginIndex < expr.size() ? expr[beginIndex].params : empty;
+}
 vector<string> Interpreter::Impl::getAttributeByIndex(size_t index) {
-  return m_exprAttribute.count(index) ? m_exprAttribute[index] : vector<string>();
+  const auto& attr = program().m_exprAttribute;
+  auto it = attr.find(index);
+  return it != attr.end() ? it->second : vector<string>();
 }
 bool Interpreter::Impl::gotoOnEntity(size_t beginIndex) {
-  if (beginIndex < m_expr.size()) {
+  if (beginIndex < program().m_expr.size()) {
     m_gotoIndex = beginIndex;
     return true;
   }
   return false;
 }
 Interpreter::UserFunction Interpreter::Impl::getUserFunction(const std::string& fname) {
-  return m_ufunc.count(fname) ? m_ufunc[fname] : nullptr;
+  auto itView = m_reg->ufuncView.find(fname);
+  if (itView != m_reg->ufuncView.end()) {
+    return [ufunc = itView->second](const vector<string>& args) ->string {
+      vector<string_view> views(args.begin(), args.end());
+      string res;
+      ufunc(Interpreter::ArgsView(views.data(), views.size()), res);
+      return res;
+    };
+  }
+  return m_reg->ufunc.count(fname) ? m_reg->ufunc.at(fname) : nullptr;
 }
 Interpreter::UserOperator Interpreter::Impl::getUserOperator(const std::string& oname) {
-  return m_uoper.count(oname) ? m_uoper[oname].first : nullptr;
+  return m_reg->uoper.count(oname) ? m_reg->uoper.at(oname).func : nullptr;
+}
+void Interpreter::Impl::useBytecode(bool on) {
+  m_bytecode = on;
+}
+void Interpreter::Impl::setScriptCacheCapacity(size_t capacity) {
+  m_cache.capacity = capacity;
+  clearScriptCache();
+}
+void Interpreter::Impl::scriptCacheStat(size_t& outHits, size_t& outMisses) const {
+  outHits = m_cache.hits;
+  outMisses = m_cache.misses;
+}
+size_t Interpreter::Impl::macroExpandedSize() const {
+  return m_macroExpandedSize;
+}
+void Interpreter::Impl::setMaxCallDepth(size_t depth) {
+  m_maxCallDepth = depth;
+}
+void Interpreter::Impl::setRunLimits(size_t maxSteps, size_t timeoutMs) {
+  m_control.stepLimit = maxSteps;
+  m_control.timeoutMs = timeoutMs;
+}
+void Interpreter::Impl::cancel() {
+  m_control.cancel = true;
+}
+Interpreter::RunStatus Interpreter::Impl::runStatus() const {
+  return m_control.status;
+}
+void Interpreter::Impl::useProfiler(bool on) {
+  m_profiling = on;
+  resetProfile();
+}
+vector<Interpreter::EntityProfile> Interpreter::Impl::profile() {
+  vector<Interpreter::EntityProfile> res;
+  for (size_t i = 0; i < m_profileItem.size() && i < m_expr.size(); ++i) {
+    if (m_profileItem[i].hits > 0)
+      res.emplace_back(Interpreter::EntityProfile{ getEntityByIndex(i), m_profileItem[i].hits, m_profileItem[i].ns });
+  }
+  return res;
+}
+string Interpreter::Impl::profileFolded() const {
+  string res;
+  for (size_t i = 1; i < m_profiler.nodes.size(); ++i) {
+    const auto& nd = m_profiler.nodes[i];
+    if (nd.selfNs == 0) continue;
+    string stack = nd.name;
+    for (size_t p = nd.parent; ; p = m_profiler.nodes[p].parent) {
+      stack = m_profiler.nodes[p].name + ";" + stack;
+      if (p == 0) break;
+    }
+    res += stack + " " + to_string(nd.selfNs) + "\n";
+  }
+  return res;
+}
+void Interpreter::Impl::useOptimization(bool on) {
+  if (m_optimize == on) return;
+  m_optimize = on;
+  m_prevScript.clear();
+  clearScriptCache();
 }
 
-string Interpreter::Impl::calcOperation(Keyword mainKeyword, size_t iExpr) {
+Interpreter::Impl::Value Interpreter::Impl::calcOperation(Keyword mainKeyword, size_t iExpr) {
 
-  string g_result;
+  Value g_result;
   switch (mainKeyword) {
   case Keyword::VARIABLE:
-    g_result = m_var[m_expr[iExpr].params];
+    g_result = m_var[m_expr[iExpr].iVar];
     break;
   case Keyword::VALUE:
     g_result = m_expr[iExpr].params;
     break;
   case Keyword::EXPRESSION:
-    g_result = m_expr[iExpr].result = calcExpression(iExpr + 1, m_expr[iExpr].iBodyEnd);
+    g_result = m_exprResult[iExpr] = calcExpression(iExpr + 1, m_expr[iExpr].iBodyEnd);
     break;
   case Keyword::FUNCTION:
-    g_result = m_expr[iExpr].result = calcFunction(iExpr);
+    g_result = m_exprResult[iExpr] = calcFunction(iExpr);
     break;
   case Keyword::WHILE:
   case Keyword::IF:
@@ -366,60 +1422,303 @@ string Interpreter::Impl::calcOperation(Keyword mainKeyword, size_t iExpr) {
   }
   return g_result;
 }
-string Interpreter::Impl::calcFunction(size_t iExpr) {
+Interpreter::Impl::Value Interpreter::Impl::calcFunction(size_t iExpr) {
     
-  string g_result;
   size_t iBegin = iExpr + 1;
   size_t iEnd = m_expr[iExpr].iConditionEnd;
-  vector<string> args;
+  ArgScope as(*this);
   for (size_t i = iBegin; i < iEnd;) {
     if ((i + 1 == m_expr[i].iBodyEnd - 1) && ((m_expr[i + 1].keyw == Keyword::VARIABLE) || (m_expr[i + 1].keyw == Keyword::VALUE))) {
       if (m_expr[i + 1].keyw == Keyword::VARIABLE)
-        m_expr[i].result = m_var[m_expr[i + 1].params];
+        m_exprResult[i] = m_var[m_expr[i + 1].iVar];
       else
-        m_expr[i].result = m_expr[i + 1].params;
+        m_exprResult[i] = m_expr[i + 1].params;
     }
     else {
-      m_expr[i].result = calcExpression(i + 1, m_expr[i].iBodyEnd);
+      m_exprResult[i] = calcExpression(i + 1, m_expr[i].iBodyEnd);
     }
-    args.emplace_back(m_expr[i].result);
+    as.frame->values.emplace_back(m_exprResult[i]);
     i = m_expr[i].iBodyEnd;
   }
+  countStep();
   m_currentIndex = iExpr;
-  const string& fname = m_expr[iExpr].params;
+  ProfileScope ps(*this, iExpr);
+  return callFunction(iExpr, *as.frame);
+}
+Interpreter::Impl::Value Interpreter::Impl::callFunction(size_t iExpr, ArgFrame& af) {
+
+  Value g_result;
+  const Impl& prog = program();
+  const string& fname = prog.m_expr[iExpr].params;
   if (m_internFunc.count(fname)) {
-    auto& impl = m_internFunc[fname];    
-    for (const auto& f : m_internFunc) {
-      if (!impl.m_internFunc.count(f.first) || impl.m_internFunc[f.first].m_prevScript.empty()){
-        impl.m_internFunc[f.first] = f.second;
-      }
-    }
-    std::set<std::string> scopeVars;
-    for (const auto& var : m_var) {
-      if (impl.m_var.count(var.first)){
-        impl.m_var[var.first] = var.second;
-        scopeVars.insert(var.first);
-      }
-    }
-    for (size_t i = 0; i < args.size(); ++i) {
-      impl.m_var["$" + to_string(i)] = args[i];
+    Impl* pImpl = internFunction(fname);
+    if (!pImpl || (m_callDepth >= m_maxCallDepth))
+      return g_result;
+
+    Impl& impl = *pImpl;
+    const bool isRecursion = impl.m_activeCalls > 0;
+    if (isRecursion)
+      impl.pushFrame();
+    ++impl.m_activeCalls;
+    impl.m_caller = this;
+    impl.m_callDepth = m_callDepth + 1;
+    impl.m_maxCallDepth = m_maxCallDepth;
+    impl.m_bytecode = m_bytecode;
+
+    // arguments belong to the call, other common variables are shared with the caller,
+    // on recursion the function is the caller and they are the same
+    vector<Value>& args = af.values;
+    for (const auto& arg : impl.m_argSlot)
+      impl.m_var[arg.second] = (arg.first < args.size()) ? move(args[arg.first]) : Value();
+    const bool isShared = &impl != this;
+    if (isShared) {
+      for (const auto& slot : impl.sharedSlots(prog))
+        impl.m_var[slot.second] = m_var[slot.first];
     }
-    
+
+    RunControl* pControl = impl.m_pControl;
+    impl.m_pControl = &control();
+    impl.m_profiling = m_profiling;
     g_result = impl.runScript();
-    
-    for (const auto& var : impl.m_var) {
-      if (scopeVars.count(var.first)){
-        m_var[var.first] = var.second;
-      }
+    impl.m_pControl = pControl;
+    if (control().status != Interpreter::RunStatus::OK)
+      m_exit = true;
+
+    if (isShared) {  // the slots are taken again, a nested call could take them for another caller
+      for (const auto& slot : impl.sharedSlots(prog))
+        m_var[slot.first] = move(impl.m_var[slot.second]);
     }
+    --impl.m_activeCalls;
+    if (isRecursion)
+      impl.popFrame();
+    else
+      impl.m_caller = nullptr;
   }
   else {
-    g_result = m_ufunc[fname](args);
+    g_result = callUserFunction(prog, fname, af);
   }
   return g_result;
 }
+Interpreter::Impl::Value Interpreter::Impl::callUserFunction(const Impl& prog, const string& fname, ArgFrame& af) {
+
+  auto itView = prog.m_reg->ufuncView.find(fname);
+  if (itView != prog.m_reg->ufuncView.end()) {
+    af.views.resize(af.values.size());
+    for (size_t i = 0; i < af.values.size(); ++i)
+      af.views[i] = af.values[i].str();
+    af.result.clear();
+    itView->second(Interpreter::ArgsView(af.views.data(), af.views.size()), af.result);
+    return Value(af.result);
+  }
+  auto it = prog.m_reg->ufunc.find(fname);
+  if (it == prog.m_reg->ufunc.end())
+    return Value();
+
+  af.strs.resize(af.values.size());
+  for (size_t i = 0; i < af.values.size(); ++i)
+    af.strs[i] = af.values[i].str();
+  return it->second(af.strs);
+}
+Interpreter::Impl* Interpreter::Impl::internFunction(const string& fname) {
+  for (Impl* impl = this; impl; impl = impl->m_caller) {
+    auto it = impl->m_internFunc.find(fname);
+    if ((it != impl->m_internFunc.end()) && it->second)
+      return it->second.get();
+    if (impl->m_funcName == fname)
+      return impl;
+  }
+  return nullptr;
+}
+bool Interpreter::Impl::isInternFunction(const string& fname) const {
+  for (const Impl* impl = this; impl; impl = impl->m_declarer) {
+    if (impl->m_internFunc.count(fname))
+      return true;
+  }
+  return false;
+}
+void Interpreter::Impl::resolveArguments() {
+  m_argSlot.clear();
+  for (const auto& var : m_varSlot) {
+    if (isArgument(var.first))
+      m_argSlot.emplace_back(stoul(var.first.substr(1)), var.second);
+  }
+}
+const vector<pair<size_t, size_t>>& Interpreter::Impl::sharedSlots(const Impl& caller) {
+  if ((m_sharedCaller == caller.m_uid.value) && (m_sharedCallerVars == caller.m_varSlot.size()))
+    return m_sharedSlot;
+
+  m_sharedSlot.clear();
+  auto itVar = caller.m_varSlot.begin();
+  for (const auto& fvar : m_varSlot) {
+    if (isArgument(fvar.first)) continue;
+    while ((itVar != caller.m_varSlot.end()) && (itVar->first < fvar.first)) ++itVar;
+    if ((itVar != caller.m_varSlot.end()) && (itVar->first == fvar.first))
+      m_sharedSlot.emplace_back(itVar->second, fvar.second);
+  }
+  m_sharedCaller = caller.m_uid.value;
+  m_sharedCallerVars = caller.m_varSlot.size();
+  return m_sharedSlot;
+}
+void Interpreter::Impl::pushFrame() {
+  if (m_frames.size() < m_activeCalls)
+    m_frames.resize(m_activeCalls);
+  Frame& fr = m_frames[m_activeCalls - 1];
+  fr.args.resize(m_argSlot.size());
+  for (size_t i = 0; i < m_argSlot.size(); ++i)
+    fr.args[i] = move(m_var[m_argSlot[i].second]);
+  fr.exprResult.resize(m_expr.size());
+  for (size_t i = 0; i < m_expr.size(); ++i)
+    fr.exprResult[i] = move(m_exprResult[i]);
+  fr.stack = move(m_stack);
+  fr.blocks = move(m_blocks);
+  fr.result = move(m_result);
+  fr.blockResult = move(m_blockResult);
+  fr.gotoIndex = m_gotoIndex;
+  fr.currentIndex = m_currentIndex;
+  fr.callDepth = m_callDepth;
+  fr.exit = m_exit;
+  fr.caller = m_caller;
+  m_stack.clear();
+  m_blocks.clear();
+  m_gotoIndex = size_t(-1);
+}
+void Interpreter::Impl::popFrame() {
+  Frame& fr = m_frames[m_activeCalls - 1];
+  for (size_t i = 0; i < m_argSlot.size(); ++i)
+    m_var[m_argSlot[i].second] = move(fr.args[i]);
+  for (size_t i = 0; i < m_expr.size(); ++i)
+    m_exprResult[i] = move(fr.exprResult[i]);
+  m_stack = move(fr.stack);
+  m_blocks = move(fr.blocks);
+  m_result = move(fr.result);
+  m_blockResult = move(fr.blockResult);
+  m_gotoIndex = fr.gotoIndex;
+  m_currentIndex = fr.currentIndex;
+  m_callDepth = fr.callDepth;
+  m_exit = fr.exit;
+  m_caller = fr.caller;
+}
+void Interpreter::Impl::cloneInternFunctions() {
+  map<const Impl*, shared_ptr<Impl>> clones;
+  cloneInternFunctions(clones);
+}
+void Interpreter::Impl::cloneInternFunctions(map<const Impl*, shared_ptr<Impl>>& clones) {
+  for (auto& f : m_internFunc) {
+    if (!f.second) continue;
+    auto it = clones.find(f.second.get());
+    if (it == clones.end()) {
+      it = clones.emplace(f.second.get(), make_shared<Impl>(*f.second)).first;
+      it->second->cloneInternFunctions(clones);
+    }
+    f.second = it->second;
+  }
+}
+Interpreter::Impl::Value Interpreter::Impl::callOperator(size_t iExpr, Value& ioLValue, Value& ioRValue) {
+
+  const Impl& prog = program();
+  const auto& uopr = prog.m_reg->uoper.find(prog.m_expr[iExpr].params)->second;
+  if ((&ioLValue == &ioRValue) && (uopr.lMutable || uopr.rMutable)) {  // the same variable on both sides
+    Value rValue = ioRValue;
+    Value result = callOperator(iExpr, ioLValue, rValue);
+    if (uopr.rMutable) ioRValue = move(rValue);
+    return result;
+  }
+  Value::Type lType = ioLValue.type(),
+              rType = ioRValue.type();
+  if (uopr.intFunc && (lType == Value::Type::INT) && (rType == Value::Type::INT)) {
+    int64_t lValue = ioLValue.toInt(), rValue = ioRValue.toInt(), result = 0;
+    if (uopr.intFunc(lValue, rValue, result)) {
+      if (uopr.lMutable && (lValue != ioLValue.toInt())) ioLValue = Value(lValue);
+      if (uopr.rMutable && (rValue != ioRValue.toInt())) ioRValue = Value(rValue);
+      return Value(result);
+    }
+  }
+  if (uopr.dblFunc && (lType == Value::Type::INT || lType == Value::Type::DOUBLE) &&
+                      (rType == Value::Type::INT || rType == Value::Type::DOUBLE)) {
+    double lValue = ioLValue.toDouble(), rValue = ioRValue.toDouble(), result = 0;
+    if (uopr.dblFunc(lValue, rValue, result)) {
+      if (uopr.lMutable && (lValue != ioLValue.toDouble())) ioLValue = Value(lValue);
+      if (uopr.rMutable && (rValue != ioRValue.toDouble())) ioRValue = Value(rValue);
+      return Value(result);
+    }
+  }
+  if (uopr.view)
+    return uopr.view(ioLValue.str(), ioRValue.str());
+
+  // the changed operand is moved out and back, the read only one is copied
+  string lOpd = uopr.lMutable ? ioLValue.release() : ioLValue.str(),
+         rOpd = uopr.rMutable ? ioRValue.release() : ioRValue.str();
+  Value result = uopr.func(lOpd, rOpd);
+  if (uopr.lMutable) ioLValue = move(lOpd);
+  if (uopr.rMutable) ioRValue = move(rOpd);
+  return result;
+}
+Interpreter::Impl::Value Interpreter::Impl::callIntKernel(const IntKernel& kernel, size_t iExpr, Value& ioLValue, Value& ioRValue) {
+
+  // the variable of type int can get other value from a function, then it is the usual call
+  if ((ioLValue.type() == Value::Type::INT) && (ioRValue.type() == Value::Type::INT)) {
+    int64_t lValue = ioLValue.toInt(), rValue = ioRValue.toInt(), result = 0;
+    if (kernel.func(lValue, rValue, result)) {
+      if (kernel.lMutable && (lValue != ioLValue.toInt())) ioLValue = Value(lValue);
+      if (kernel.rMutable && (rValue != ioRValue.toInt())) ioRValue = Value(rValue);
+      return Value(result);
+    }
+  }
+  return callOperator(iExpr, ioLValue, ioRValue);
+}
+bool Interpreter::Impl::isPlainOperand(size_t iOpd, size_t iRes) const {
+
+  // calculation of operand does not change variables, so the left variable can be read after it
+  return (iOpd == size_t(-1)) || (iRes != NO_OPERAND) ||
+         (m_expr[iOpd].keyw == Keyword::VARIABLE) || (m_expr[iOpd].keyw == Keyword::VALUE);
+}
+const Interpreter::Impl::Value& Interpreter::Impl::entityResult(size_t iExpr) const {
+
+  // the variables are bound to operators, their values are not copied to results
+  const auto& ex = program().m_expr[iExpr];
+  return (ex.keyw == Keyword::VARIABLE) && (ex.iVar < m_var.size()) ? m_var[ex.iVar] : m_exprResult[iExpr];
+}
+bool Interpreter::Impl::isBinding(size_t iExpr) const {
+
+  // while($v : container), the container is the rest of condition
+  const Impl& prog = program();
+  const auto& ex = prog.m_expr[iExpr];
+  return (ex.keyw == Keyword::WHILE) && (iExpr + 3 < ex.iConditionEnd) &&
+         (prog.m_expr[iExpr + 1].keyw == Keyword::VARIABLE) &&
+         (prog.m_expr[iExpr + 2].keyw == Keyword::OPERATOR) && (prog.m_expr[iExpr + 2].params == ":");
+}
+void Interpreter::Impl::beginBinding(Value container, Binding& ioBind) {
+
+  const Impl& prog = program();
+  ioBind.iter = nullptr;
+  for (auto it = prog.m_reg->iterable.rbegin(); !ioBind.iter && (it != prog.m_reg->iterable.rend()); ++it)
+    ioBind.iter = (*it)(container.str());
+  ioBind.container = move(container);
+}
+Interpreter::Impl::Value Interpreter::Impl::nextBinding(size_t iExpr, Binding& ioBind) {
+
+  const Impl& prog = program();
+  const size_t iVar = iExpr + 1,
+               iOpr = iExpr + 2;
+  Value& var = m_var[prog.m_expr[iVar].iVar];
+  if (ioBind.iter) {
+    if (!ioBind.iter(ioBind.value))
+      return m_exprResult[iOpr] = Value(int64_t(0));
+    var = Value(ioBind.value);
+    return m_exprResult[iOpr] = Value(int64_t(1));
+  }
+  Value rValue = ioBind.container;
+  countStep();
+  m_currentIndex = iOpr;
+  {
+    ProfileScope ps(*this, iOpr);
+    m_exprResult[iOpr] = callOperator(iOpr, var, rValue);
+  }
+  return m_exprResult[iOpr];
+}
 string Interpreter::Impl::calcCondition(size_t iExpr) {
 
+  ProfileScope ps(*this, iExpr, m_expr[iExpr].keyw == Keyword::WHILE);
   string g_result;
   size_t iBegin = iExpr + 1;
   size_t iCondEnd = m_expr[iExpr].iConditionEnd;
@@ -427,26 +1726,29 @@ string Interpreter::Impl::calcCondition(size_t iExpr) {
   if ((m_expr[iExpr].keyw == Keyword::ELSE) || (m_expr[iExpr].keyw == Keyword::ELSE_IF)) {
     size_t iIF = stoul(m_expr[iExpr].params);
     if (iIF != size_t(-1)) {
-      string ifCondn = m_expr[iIF].result;
-      bool isNum = isNumber(ifCondn);
-      if ((isNum && (stoi(ifCondn) != 0)) || (!isNum && !ifCondn.empty())) {
+      if (isTrue(m_exprResult[iIF])) {
         return g_result;
       }
     }
     else return g_result;
   }
-  string condn;
-  if (iBegin < iCondEnd) {
-    condn = m_expr[iExpr].result = calcExpression(iBegin, iCondEnd);
+  Value condn;
+  Binding bind;
+  const bool isBind = isBinding(iExpr);
+  if (isBind) {
+    beginBinding(calcExpression(iBegin + 2, iCondEnd), bind);
+    condn = m_exprResult[iExpr] = nextBinding(iExpr, bind);
   }
-  bool isNum = isNumber(condn);
-  if ((m_expr[iExpr].keyw == Keyword::ELSE) || (isNum && (stoi(condn) != 0)) || (!isNum && !condn.empty())) {
+  else if (iBegin < iCondEnd) {
+    condn = m_exprResult[iExpr] = calcExpression(iBegin, iCondEnd);
+  }
+  if ((m_expr[iExpr].keyw == Keyword::ELSE) || isTrue(condn)) {
     bool isContinue = false,
       isBreak = false;
     for (size_t i = iCondEnd; i < iBodyEnd;) {
       switch (m_expr[i].keyw) {
       case Keyword::EXPRESSION: {
-        m_expr[i].result = calcExpression(i + 1, m_expr[i].iBodyEnd);
+        m_exprResult[i] = calcExpression(i + 1, m_expr[i].iBodyEnd);
         i = m_expr[i].iBodyEnd;
       }
         break;
@@ -488,8 +1790,6 @@ string Interpreter::Impl::calcCondition(size_t iExpr) {
 
       if (m_gotoIndex != size_t(-1)) {
         if ((iCondEnd <= m_gotoIndex) && (m_gotoIndex < iBodyEnd)) {
-          for (size_t j = m_gotoIndex; j < i; ++j)
-            m_expr[j].iOperator = size_t(-1);
           i = m_gotoIndex;
           m_gotoIndex = size_t(-1);
         }
@@ -500,177 +1800,864 @@ string Interpreter::Impl::calcCondition(size_t iExpr) {
 
       if ((m_expr[iExpr].keyw == Keyword::WHILE) && (i >= iBodyEnd)) {
         isContinue = false;
+        if (countStep()) break;
 
-        for (size_t j = iBegin; j < iCondEnd; ++j)
-          m_expr[j].iOperator = size_t(-1);
-
-        const string& condn = m_expr[iExpr].result = calcExpression(iBegin, iCondEnd);
-        bool isNum = isNumber(condn);
-        if ((isNum && (stoi(condn) != 0)) || (!isNum && !condn.empty())) {
-          for (size_t j = iCondEnd; j < iBodyEnd; ++j)
-            m_expr[j].iOperator = size_t(-1);
+        m_exprResult[iExpr] = isBind ? nextBinding(iExpr, bind) : calcExpression(iBegin, iCondEnd);
+        if (isTrue(m_exprResult[iExpr]))
           i = iCondEnd;
-        }
       }
     }
   }
   return g_result;
 }
-string Interpreter::Impl::calcExpression(size_t iBegin, size_t iEnd) {
+Interpreter::Impl::Value Interpreter::Impl::calcExpression(size_t iBegin, size_t iEnd) {
 
   if (iBegin + 1 == iEnd) {
     if (m_expr[iBegin].keyw == Keyword::VARIABLE)
-      return m_var[m_expr[iBegin].params];
+      return m_var[m_expr[iBegin].iVar];
     if (m_expr[iBegin].keyw == Keyword::VALUE)
       return m_expr[iBegin].params;
     return calcOperation(m_expr[iBegin].keyw, iBegin);
   }
 
-  bool firstRun = m_soper.find(iBegin) == m_soper.end();
-  if (firstRun)
-    m_soper.insert({ iBegin, vector<Operatr>() });
-
-  vector<Operatr>& oprs = m_soper[iBegin];
-  if (firstRun) {
-    calcOperatorPriority(iBegin, iEnd, oprs);
-  }
+  vector<Operatr> localOprs;  // the postfix is made on compiling, an expression out of it is not expected
+  if (m_expr[iBegin].iPostfix == size_t(-1))
+    calcPostfix(iBegin, iEnd, localOprs);
+  const vector<Operatr>& oprs = (m_expr[iBegin].iPostfix != size_t(-1)) ? m_postfix[m_expr[iBegin].iPostfix] : localOprs;
 
   if (oprs.empty()) {
     return calcOperation(m_expr[iBegin].keyw, iBegin);
   }
 
-  string g_result;
-  for (auto& op : oprs) {
+  Value g_result;
+  for (const auto& op : oprs) {
+    countStep();
     size_t iOp = op.inx;
-    Expression* pLeftOperd = nullptr,
-      * pRightOperd = nullptr;
-    string lValue, rValue;
+    Value lValue, rValue;
+    Value* lOpd = &lValue, *rOpd = &rValue;
+    size_t lVar = size_t(-1);  // slot of the left variable read before the right operand
     if (op.iLOpr != size_t(-1)) { // left operand
-      pLeftOperd = &m_expr[op.iLOpr];
-      if (pLeftOperd->iOperator == size_t(-1)) {
-        if (pLeftOperd->keyw == Keyword::VARIABLE)
-          lValue = m_var[m_expr[op.iLOpr].params];
-        else if (pLeftOperd->keyw == Keyword::VALUE)
-          lValue = m_expr[op.iLOpr].params;
+      if (op.iLRes != NO_OPERAND)
+        lValue = m_exprResult[oprs[op.iLRes].inx];
+      else if (m_expr[op.iLOpr].keyw == Keyword::VARIABLE) {
+        if (isPlainOperand(op.iROpr, op.iRRes))
+          lOpd = &m_var[m_expr[op.iLOpr].iVar];
         else
-          lValue = calcOperation(pLeftOperd->keyw, op.iLOpr);
+          lValue = m_var[lVar = m_expr[op.iLOpr].iVar];
       }
+      else if (m_expr[op.iLOpr].keyw == Keyword::VALUE)
+        lValue = m_expr[op.iLOpr].params;
       else
-        lValue = m_expr[pLeftOperd->iOperator].result;
+        lValue = calcOperation(m_expr[op.iLOpr].keyw, op.iLOpr);
     }
     if (op.iROpr != size_t(-1)) { // right operand
-      pRightOperd = &m_expr[op.iROpr];
-      if (pRightOperd->iOperator == size_t(-1)) {
-        if (pRightOperd->keyw == Keyword::VARIABLE)
-          rValue = m_var[m_expr[op.iROpr].params];
-        else if (pRightOperd->keyw == Keyword::VALUE)
-          rValue = m_expr[op.iROpr].params;
-        else
-          rValue = calcOperation(pRightOperd->keyw, op.iROpr);
-      }
+      if (op.iRRes != NO_OPERAND)
+        rValue = m_exprResult[oprs[op.iRRes].inx];
+      else if (m_expr[op.iROpr].keyw == Keyword::VARIABLE)
+        rOpd = &m_var[m_expr[op.iROpr].iVar];
+      else if (m_expr[op.iROpr].keyw == Keyword::VALUE)
+        rValue = m_expr[op.iROpr].params;
       else
-        rValue = m_expr[pRightOperd->iOperator].result;
+        rValue = calcOperation(m_expr[op.iROpr].keyw, op.iROpr);
     }
     m_currentIndex = iOp;
-    g_result = m_expr[iOp].result = m_uoper[m_expr[iOp].params].first(lValue, rValue);
+    {
+      ProfileScope ps(*this, iOp);
+      g_result = m_exprResult[iOp] = callOperator(iOp, *lOpd, *rOpd);
+    }
+    if ((lVar != size_t(-1)) && m_reg->uoper.find(m_expr[iOp].params)->second.lMutable)
+      m_var[lVar] = move(lValue);
+  }
+  return g_result;
+}
+void Interpreter::Impl::calcPostfix(size_t iBegin, size_t iEnd, vector<Operatr>& oprs) {
 
-    if (pLeftOperd && (pLeftOperd->keyw == Keyword::VARIABLE) && (pLeftOperd->iOperator == size_t(-1))) {
-      pLeftOperd->result = m_var[pLeftOperd->params] = lValue;
+  size_t iLOpr = size_t(-1);
+  for (size_t i = iBegin; i < iEnd;) {
+    if (m_expr[i].keyw == Keyword::FUNCTION) {
+      iLOpr = i;
+      i = m_expr[i].iConditionEnd;
+      continue;
     }
-    if (pRightOperd && (pRightOperd->keyw == Keyword::VARIABLE) && (pRightOperd->iOperator == size_t(-1))) {
-      pRightOperd->result = m_var[pRightOperd->params] = rValue;
+    if (m_expr[i].keyw == Keyword::EXPRESSION) {
+      iLOpr = i;
+      i = m_expr[i].iBodyEnd;
+      continue;
+    }
+    if (m_expr[i].keyw == Keyword::OPERATOR) {
+      uint32_t priority = m_reg->uoper.at(m_expr[i].params).priority;
+      size_t iROpr = (i < iEnd - 1) ? i + 1 : size_t(-1);
+      oprs.emplace_back<Operatr>({ i, priority, iLOpr, iROpr, NO_OPERAND, NO_OPERAND });  // inx, priority
+    }
+    iLOpr = i;
+    ++i;
+  }
+
+  size_t osz = oprs.size();
+  if (osz > 1) {
+    if (osz == 2) {
+      if (oprs[0].priority > oprs[1].priority) swap(oprs[0], oprs[1]);
     }
-    if (pLeftOperd) {
-      if (pLeftOperd->iOperator != size_t(-1)) {
-        size_t iLOp = pLeftOperd->iOperator;
-        for (size_t i = iBegin; i < iEnd; ++i) {
-          if (m_expr[i].iOperator == iLOp)
-            m_expr[i].iOperator = iOp;
+    else if (osz == 3) {
+      if (oprs[0].priority < oprs[1].priority) {
+        if (oprs[2].priority < oprs[0].priority) swap(oprs[0], oprs[2]);
+      }
+      else {
+        if (oprs[1].priority < oprs[2].priority) swap(oprs[0], oprs[1]);
+        else swap(oprs[0], oprs[2]);
+      }
+      if (oprs[2].priority < oprs[1].priority) swap(oprs[1], oprs[2]);
+    }
+    else if (osz < 10) { // faster than std::sort on small distance
+      for (size_t i = 0; i < osz - 2; ++i) {
+        size_t iMin = i;
+        size_t minPriort = oprs[i].priority;
+        for (size_t j = i + 1; j < osz; ++j) {
+          if (oprs[j].priority < minPriort) {
+            minPriort = oprs[j].priority;
+            iMin = j;
+          }
         }
+        if (iMin != i) swap(oprs[i], oprs[iMin]);
       }
-      else pLeftOperd->iOperator = iOp;
-    }
-    if (pRightOperd) {
-      if (pRightOperd->iOperator != size_t(-1)) {
-        size_t iROp = pRightOperd->iOperator;
-        for (size_t i = iBegin; i < iEnd; ++i) {
-          if (m_expr[i].iOperator == iROp)
-            m_expr[i].iOperator = iOp;
+      if (oprs[osz - 2].priority > oprs[osz - 1].priority) swap(oprs[osz - 2], oprs[osz - 1]);
+    }
+    else {
+      sort(oprs.begin(), oprs.end(), [](const Operatr& l, const Operatr& r) {
+        return l.priority < r.priority;
+        });
+    }
+  }
+
+  // every operator takes the result of the last operator that has consumed its neighbor
+  vector<size_t> oprLinks(iEnd - iBegin, NO_OPERAND);  // position of operator by operand
+  for (size_t k = 0; k < oprs.size(); ++k) {
+    Operatr& op = oprs[k];
+    if (op.iLOpr != size_t(-1))
+      op.iLRes = oprLinks[op.iLOpr - iBegin];
+    if (op.iROpr != size_t(-1))
+      op.iRRes = oprLinks[op.iROpr - iBegin];
+
+    for (size_t iOpd : { op.iLOpr, op.iROpr }) {
+      if (iOpd == size_t(-1)) continue;
+      size_t iLink = oprLinks[iOpd - iBegin];
+      if (iLink != NO_OPERAND) {
+        for (auto& lnk : oprLinks) {
+          if (lnk == iLink)
+            lnk = k;
         }
       }
-      else pRightOperd->iOperator = iOp;
+      else oprLinks[iOpd - iBegin] = k;
+    }
+  }
+}
+
+void Interpreter::Impl::optimizeScript() {
+
+  optimizeInstruction(0, m_expr.size());
+}
+size_t Interpreter::Impl::optimizeInstruction(size_t iBegin, size_t iEnd) {
+
+  for (size_t i = iBegin; i < iEnd;) {
+    const size_t exprSize = m_expr.size();
+    switch (m_expr[i].keyw) {
+    case Keyword::EXPRESSION: {
+      foldStatement(i + 1, m_expr[i].iBodyEnd);
+      i = m_expr[i].iBodyEnd;
+    }
+      break;
+    case Keyword::IF: {
+      size_t iNext = pruneCondition(i, iEnd);
+      if (iNext != size_t(-1)) {
+        iEnd -= exprSize - m_expr.size();
+        i = iNext;
+        continue;
+      }
+    }
+    [[fallthrough]];
+    case Keyword::WHILE:
+    case Keyword::ELSE:
+    case Keyword::ELSE_IF: {
+      foldStatement(i + 1, m_expr[i].iConditionEnd);
+      optimizeInstruction(m_expr[i].iConditionEnd, m_expr[i].iBodyEnd);
+      i = m_expr[i].iBodyEnd;
+    }
+      break;
+    default:
+      ++i;
+      break;
+    }
+    iEnd -= exprSize - m_expr.size();
+  }
+  return iEnd;
+}
+size_t Interpreter::Impl::pruneCondition(size_t iExpr, size_t iEnd) {
+
+  // chain if - elseif - else, branches are linked by index of previous branch
+  vector<size_t> chain{ iExpr };
+  size_t iChainEnd = m_expr[iExpr].iBodyEnd;
+  while (iChainEnd < iEnd) {
+    const Expression& ex = m_expr[iChainEnd];
+    if (((ex.keyw != Keyword::ELSE) && (ex.keyw != Keyword::ELSE_IF)) || (stoul(ex.params) != chain.back()))
+      break;
+    chain.push_back(iChainEnd);
+    iChainEnd = ex.iBodyEnd;
+  }
+  for (const auto& lb : m_label) {
+    if ((lb.second != size_t(-1)) && (iExpr < lb.second) && (lb.second < iChainEnd))
+      return size_t(-1);
+  }
+  size_t iTaken = size_t(-1);
+  for (size_t iBranch : chain) {
+    if (m_expr[iBranch].keyw == Keyword::ELSE) {
+      iTaken = iBranch;
+      break;
     }
+    Value condn;
+    vector<Folding> folds;
+    if (!foldExpression(iBranch + 1, m_expr[iBranch].iConditionEnd, condn, folds))
+      return size_t(-1);
+    if (isTrue(condn)) {
+      iTaken = iBranch;
+      break;
+    }
+  }
+  if (iTaken == size_t(-1)) {
+    eraseEntities(iExpr, iChainEnd);
+    return iExpr;
+  }
+  size_t iBodyBegin = m_expr[iTaken].iConditionEnd,
+         iBodyEnd = m_expr[iTaken].iBodyEnd;
+  for (size_t i = iBodyBegin; i < iBodyEnd; ++i) {
+    if ((m_expr[i].keyw == Keyword::BREAK) || (m_expr[i].keyw == Keyword::CONTINUE))
+      return size_t(-1);
+  }
+  size_t bodySize = optimizeInstruction(iBodyBegin, iBodyEnd) - iBodyBegin;
+  iChainEnd -= iBodyEnd - (iBodyBegin + bodySize);
+
+  eraseEntities(iBodyBegin + bodySize, iChainEnd);
+  eraseEntities(iExpr, iBodyBegin);
+  return iExpr + bodySize;
+}
+void Interpreter::Impl::foldStatement(size_t iBegin, size_t iEnd) {
+
+  if ((iBegin + 1 == iEnd) && (m_expr[iBegin].keyw == Keyword::VALUE))
+    return;
+
+  Value value;
+  vector<Folding> folds;
+  if (foldExpression(iBegin, iEnd, value, folds))
+    folds.assign(1, Folding{ iBegin, iEnd, move(value) });
+  applyFoldings(folds);
+}
+bool Interpreter::Impl::foldExpression(size_t iBegin, size_t iEnd, Value& outValue, vector<Folding>& folds) {
+
+  if (iBegin >= iEnd) return false;
+
+  vector<Operatr> oprs;
+  calcPostfix(iBegin, iEnd, oprs);
+
+  if (oprs.empty())
+    return foldOperand(iBegin, outValue, folds);
+
+  // every operator is a node of tree, by position in postfix
+  struct Node {
+    size_t iBegin, iEnd;
+    bool isConst;
+    Value value;
+  };
+  vector<Node> nodes;
+  bool isConst = true;
+  for (auto& op : oprs) {
+    Node opds[2];
+    size_t iOpds[2] = { op.iLOpr, op.iROpr },
+           iRess[2] = { op.iLRes, op.iRRes };
+    bool isOpdsConst = true;
+    for (size_t k = 0; k < 2; ++k) {
+      size_t iOpd = iOpds[k];
+      if (iOpd == size_t(-1)) {
+        isOpdsConst = false;
+        continue;
+      }
+      if (iRess[k] != NO_OPERAND)
+        opds[k] = nodes[iRess[k]];
+      else {
+        size_t iOpdEnd = iOpd + 1;
+        if (m_expr[iOpd].keyw == Keyword::FUNCTION) iOpdEnd = m_expr[iOpd].iConditionEnd;
+        else if (m_expr[iOpd].keyw == Keyword::EXPRESSION) iOpdEnd = m_expr[iOpd].iBodyEnd;
+        opds[k] = Node{ iOpd, iOpdEnd, false, Value() };
+        opds[k].isConst = foldOperand(iOpd, opds[k].value, folds);
+      }
+      isOpdsConst = isOpdsConst && opds[k].isConst;
+    }
+    Node nd{ op.inx, op.inx + 1, isOpdsConst && m_reg->uoper.at(m_expr[op.inx].params).pure, Value() };
+    if (nd.isConst) {
+      nd.iBegin = opds[0].iBegin;
+      nd.iEnd = opds[1].iEnd;
+      m_currentIndex = op.inx;
+      try {
+        nd.value = callOperator(op.inx, opds[0].value, opds[1].value);
+      }
+      catch (...) {  // left for running, maybe the branch is never reached
+        nd.isConst = false;
+      }
+    }
+    if (!nd.isConst) {
+      isConst = false;
+      for (size_t k = 0; k < 2; ++k) {  // the biggest constant operands
+        if ((iOpds[k] != size_t(-1)) && opds[k].isConst &&
+          ((opds[k].iBegin + 1 < opds[k].iEnd) || (m_expr[opds[k].iBegin].keyw != Keyword::VALUE)))
+          folds.push_back(Folding{ opds[k].iBegin, opds[k].iEnd, move(opds[k].value) });
+      }
+    }
+    nodes.push_back(move(nd));
+  }
+  if (isConst)
+    outValue = move(nodes.back().value);
+  return isConst;
+}
+bool Interpreter::Impl::foldOperand(size_t iOpd, Value& outValue, vector<Folding>& folds) {
+
+  switch (m_expr[iOpd].keyw) {
+  case Keyword::VALUE:
+    outValue = m_expr[iOpd].params;
+    return true;
+  case Keyword::EXPRESSION:
+    return foldExpression(iOpd + 1, m_expr[iOpd].iBodyEnd, outValue, folds);
+  case Keyword::FUNCTION: {
+    const string& fname = m_expr[iOpd].params;
+    bool isConst = m_reg->pureFunc.count(fname) && (m_reg->ufunc.count(fname) || m_reg->ufuncView.count(fname)) && !m_internFunc.count(fname);
+    ArgScope as(*this);
+    vector<Folding> argFolds;
+    for (size_t i = iOpd + 1; i < m_expr[iOpd].iConditionEnd; i = m_expr[i].iBodyEnd) {
+      Value arg;
+      if (foldExpression(i + 1, m_expr[i].iBodyEnd, arg, folds)) {
+        if ((i + 2 < m_expr[i].iBodyEnd) || (m_expr[i + 1].keyw != Keyword::VALUE))
+          argFolds.push_back(Folding{ i + 1, m_expr[i].iBodyEnd, arg });
+        as.frame->values.push_back(move(arg));
+      }
+      else isConst = false;
+    }
+    if (isConst) {
+      m_currentIndex = iOpd;
+      try {
+        outValue = callUserFunction(*this, fname, *as.frame);
+        return true;
+      }
+      catch (...) {}
+    }
+    folds.insert(folds.end(), make_move_iterator(argFolds.begin()), make_move_iterator(argFolds.end()));
+    return false;
+  }
+  default:
+    return false;
+  }
+}
+void Interpreter::Impl::applyFoldings(vector<Folding>& folds) {
+
+  // from the end, so indexes of the remaining foldings stay the same
+  sort(folds.begin(), folds.end(), [](const Folding& l, const Folding& r) {
+    return l.iBegin > r.iBegin;
+  });
+  for (auto& fd : folds) {
+    Expression& ex = m_expr[fd.iBegin];
+    ex.keyw = Keyword::VALUE;
+    ex.iConditionEnd = ex.iBodyEnd = fd.iBegin;
+    ex.iPostfix = size_t(-1);
+    ex.params = fd.value.release();
+    ex.value = Value();
+    ex.iVar = size_t(-1);
+    eraseEntities(fd.iBegin + 1, fd.iEnd);
+  }
+}
+void Interpreter::Impl::eraseEntities(size_t iBegin, size_t iEnd) {
+
+  if (iBegin >= iEnd) return;
+
+  const size_t cnt = iEnd - iBegin;
+  auto shift = [iBegin, iEnd, cnt](size_t& inx) {
+    if (inx == size_t(-1)) return;
+    if (inx >= iEnd) inx -= cnt;
+    else if (inx > iBegin) inx = iBegin;
+  };
+  m_expr.erase(m_expr.begin() + iBegin, m_expr.begin() + iEnd);
+  for (auto& ex : m_expr) {
+    shift(ex.iConditionEnd);
+    shift(ex.iBodyEnd);
+    if ((ex.keyw == Keyword::ELSE) || (ex.keyw == Keyword::ELSE_IF)) {
+      size_t iIF = stoul(ex.params);
+      shift(iIF);
+      ex.params = to_string(iIF);
+    }
+  }
+  for (auto& lb : m_label)
+    shift(lb.second);
+
+  map<size_t, vector<string>> exprAttribute;
+  for (auto& attr : m_exprAttribute) {
+    if (attr.first < iBegin)
+      exprAttribute.emplace(attr.first, move(attr.second));
+    else if (attr.first >= iEnd)
+      exprAttribute.emplace(attr.first - cnt, move(attr.second));
+  }
+  m_exprAttribute = move(exprAttribute);
+}
+
+void Interpreter::Impl::compileScript() {
+
+  m_code.clear();
+  m_const.clear();
+  m_postfix.clear();
+  m_intKernel.clear();
+  m_exprPc.assign(m_expr.size() + 1, size_t(-1));
+
+  compileInstruction(0, m_expr.size());
+
+  m_exprPc[m_expr.size()] = m_code.size();
+}
+void Interpreter::Impl::compileInstruction(size_t iBegin, size_t iEnd) {
+
+  for (size_t i = iBegin; i < iEnd;) {
+    m_exprPc[i] = m_code.size();
+    switch (m_expr[i].keyw) {
+    case Keyword::EXPRESSION: {
+      compileExpression(i + 1, m_expr[i].iBodyEnd);
+      emit(OpCode::STATEMENT, i);
+      i = m_expr[i].iBodyEnd;
+    }
+      break;
+    case Keyword::WHILE:
+    case Keyword::IF:
+    case Keyword::ELSE:
+    case Keyword::ELSE_IF: {
+      size_t iCondEnd = m_expr[i].iConditionEnd,
+             iBodyEnd = m_expr[i].iBodyEnd,
+             iIF = size_t(-1);
+      if ((m_expr[i].keyw == Keyword::ELSE) || (m_expr[i].keyw == Keyword::ELSE_IF))
+        iIF = stoul(m_expr[i].params);
+
+      size_t pcEnter = m_code.size(),
+             pcCondition = size_t(-1);
+      emit(OpCode::ENTER, i, 0, iIF);
+
+      if (isBinding(i)) {
+        compileExpression(i + 3, iCondEnd);
+        emit(OpCode::BIND, i);
+        pcCondition = m_code.size();
+        emit(OpCode::ITERATE, i);
+      }
+      else if (i + 1 < iCondEnd) {
+        compileExpression(i + 1, iCondEnd);
+        pcCondition = m_code.size();
+        emit(OpCode::CONDITION, i);
+      }
+      else if (m_expr[i].keyw != Keyword::ELSE) {
+        emitValue(size_t(-1));
+        pcCondition = m_code.size();
+        emit(OpCode::CONDITION, i);
+      }
+      compileInstruction(iCondEnd, iBodyEnd);
+
+      if (m_expr[i].keyw == Keyword::WHILE)
+        emit(OpCode::LOOP, i);
+
+      m_code[pcEnter].a = m_code.size();
+      if (pcCondition != size_t(-1))
+        m_code[pcCondition].a = m_code.size();
+      emit(OpCode::LEAVE, i);
+
+      i = iBodyEnd;
+    }
+      break;
+    case Keyword::BREAK:
+      emit(OpCode::BREAK, i);
+      ++i;
+      break;
+    case Keyword::CONTINUE:
+      emit(OpCode::CONTINUE, i);
+      ++i;
+      break;
+    case Keyword::GOTO:
+      emit(OpCode::GOTO, i);
+      ++i;
+      break;
+    default:
+      m_exprPc[i] = size_t(-1);
+      i = max(i + 1, max(m_expr[i].iConditionEnd, m_expr[i].iBodyEnd));
+      break;
+    }
+  }
+}
+void Interpreter::Impl::compileExpression(size_t iBegin, size_t iEnd) {
+
+  if (iBegin + 1 == iEnd) {
+    if (m_expr[iBegin].keyw == Keyword::VARIABLE)
+      emit(OpCode::LOAD_VARIABLE, iBegin);
+    else if (m_expr[iBegin].keyw == Keyword::VALUE)
+      emitValue(iBegin);
+    else
+      compileOperation(iBegin);
+    return;
+  }
+
+  vector<Operatr> oprs;
+  calcPostfix(iBegin, iEnd, oprs);
+
+  // the postfix is kept for walking on entities
+  m_expr[iBegin].iPostfix = m_postfix.size();
+  m_postfix.push_back(oprs);
+
+  if (oprs.empty()) {
+    if (iBegin < m_expr.size())
+      compileOperation(iBegin);
+    else
+      emitValue(size_t(-1));
+    return;
+  }
+
+  vector<bool> intResult(oprs.size(), false);  // result of integer kernel
+  for (size_t k = 0; k < oprs.size(); ++k) {
+    const auto& uopr = m_reg->uoper.find(m_expr[oprs[k].inx].params)->second;
+    checkOperandTypes(oprs[k], uopr);
+    size_t lOpd = NO_OPERAND,
+           rOpd = NO_OPERAND;
+    if (oprs[k].iLOpr != size_t(-1))
+      lOpd = compileOperand(oprs[k].iLOpr, oprs[k].iLRes, oprs, isPlainOperand(oprs[k].iROpr, oprs[k].iRRes), uopr.lMutable);
+    if (oprs[k].iROpr != size_t(-1))
+      rOpd = compileOperand(oprs[k].iROpr, oprs[k].iRRes, oprs, true, uopr.rMutable);
+
+    if (uopr.intFunc && isIntOperand(oprs[k].iLOpr, oprs[k].iLRes, intResult) && isIntOperand(oprs[k].iROpr, oprs[k].iRRes, intResult)) {
+      intResult[k] = true;
+      emit(OpCode::CALL_OPERATOR_INT, oprs[k].inx, lOpd, rOpd, uint32_t(m_intKernel.size()));
+      m_intKernel.push_back(IntKernel{ uopr.intFunc, uopr.lMutable, uopr.rMutable });
+    }
+    else
+      emit(OpCode::CALL_OPERATOR, oprs[k].inx, lOpd, rOpd);
+  }
+  emit(OpCode::PUSH_RESULT, oprs.back().inx);
+}
+size_t Interpreter::Impl::compileOperand(size_t iOpd, size_t iRes, const vector<Operatr>& oprs, bool bind, bool isMutable) {
+
+  if (iRes != NO_OPERAND) {
+    emit(OpCode::PUSH_RESULT, oprs[iRes].inx);
+    return OPERAND;
+  }
+  if (m_expr[iOpd].keyw == Keyword::VARIABLE) {
+    if (bind)
+      return BOUND | iOpd;
+    emit(OpCode::LOAD_VARIABLE, iOpd);
+    return isMutable ? iOpd : OPERAND;
+  }
+  if (m_expr[iOpd].keyw == Keyword::VALUE)
+    emitValue(iOpd);
+  else
+    compileOperation(iOpd);
+  return OPERAND;
+}
+bool Interpreter::Impl::declareTypes() {
+
+  // "$a: int" is the declaration of static type, the operator and the type are removed
+  for (size_t i = 0; i + 2 < m_expr.size(); ++i) {
+    if ((m_expr[i].keyw != Keyword::VARIABLE) || (m_expr[i + 1].keyw != Keyword::OPERATOR) || (m_expr[i + 1].params != ":") ||
+        (m_expr[i + 2].keyw != Keyword::VALUE) || !m_reg->type.count(m_expr[i + 2].params) ||
+        ((i > 0) && (m_expr[i - 1].keyw == Keyword::WHILE)))  // while($v : container)
+      continue;
+    const string& tname = m_expr[i + 2].params;
+    auto vtype = m_varType.emplace(m_expr[i].iVar, tname);
+    if (vtype.first->second != tname) {
+      m_err = "Error type: " + m_expr[i].params + " is " + vtype.first->second + ", declared " + tname;
+      return false;
+    }
+    eraseEntities(i + 1, i + 3);
+  }
+  return true;
+}
+bool Interpreter::Impl::staticType(size_t iOpd, size_t iRes, Interpreter::ValueType& outType) const {
+
+  // constants and declared variables, the results of operators and functions are not known
+  if ((iOpd == size_t(-1)) || (iRes != NO_OPERAND))
+    return false;
+  const Expression& ex = m_expr[iOpd];
+  if (ex.keyw == Keyword::VALUE) {
+    outType = Value(ex.params).type() == Value::Type::INT ? Interpreter::ValueType::INT : Interpreter::ValueType::STRING;
+    return true;
+  }
+  if (ex.keyw == Keyword::VARIABLE) {
+    auto it = m_varType.find(ex.iVar);
+    if (it != m_varType.end()) {
+      outType = m_reg->type.find(it->second)->second;
+      return true;
+    }
+  }
+  return false;
+}
+bool Interpreter::Impl::isIntOperand(size_t iOpd, size_t iRes, const vector<bool>& intResult) const {
+
+  if ((iOpd != size_t(-1)) && (iRes != NO_OPERAND))
+    return intResult[iRes];
+  Interpreter::ValueType type;
+  return staticType(iOpd, iRes, type) && (type == Interpreter::ValueType::INT);
+}
+void Interpreter::Impl::checkOperandTypes(const Operatr& op, const UserOperator& uopr) {
+
+  // the changed variable of type int gets only int constants and variables
+  const size_t iOpds[2] = { op.iLOpr, op.iROpr },
+               iRess[2] = { op.iLRes, op.iRRes };
+  const bool isMutable[2] = { uopr.lMutable, uopr.rMutable };
+  for (size_t k = 0; k < 2; ++k) {
+    Interpreter::ValueType varType, srcType;
+    if (!isMutable[k] || !staticType(iOpds[k], iRess[k], varType) || (m_expr[iOpds[k]].keyw != Keyword::VARIABLE) ||
+        !staticType(iOpds[1 - k], iRess[1 - k], srcType) || (varType != Interpreter::ValueType::INT) || (srcType == varType))
+      continue;
+    if (m_err.empty())
+      m_err = "Error type: " + m_expr[iOpds[k]].params + " is " + m_varType[m_expr[iOpds[k]].iVar] + ", assigned " + m_expr[iOpds[1 - k]].params;
+  }
+}
+void Interpreter::Impl::compileOperation(size_t iExpr) {
+
+  switch (m_expr[iExpr].keyw) {
+  case Keyword::VARIABLE:
+    emit(OpCode::LOAD_VARIABLE, iExpr);
+    break;
+  case Keyword::VALUE:
+    emitValue(iExpr);
+    break;
+  case Keyword::EXPRESSION:
+    compileExpression(iExpr + 1, m_expr[iExpr].iBodyEnd);
+    emit(OpCode::STORE_RESULT, iExpr);
+    break;
+  case Keyword::FUNCTION:
+    compileFunction(iExpr);
+    break;
+  default:
+    emitValue(size_t(-1));
+    break;
   }
-  return g_result;
 }
-void Interpreter::Impl::calcOperatorPriority(size_t iBegin, size_t iEnd, vector<Operatr>& oprs) {
+void Interpreter::Impl::compileFunction(size_t iExpr) {
 
-  size_t iLOpr = size_t(-1);
-  for (size_t i = iBegin; i < iEnd;) {
-    if (m_expr[i].keyw == Keyword::FUNCTION) {
-      iLOpr = i;
-      i = m_expr[i].iConditionEnd;
-      continue;
-    }
-    if (m_expr[i].keyw == Keyword::EXPRESSION) {
-      iLOpr = i;
-      i = m_expr[i].iBodyEnd;
-      continue;
+  size_t iEnd = m_expr[iExpr].iConditionEnd,
+         argCnt = 0;
+  for (size_t i = iExpr + 1; i < iEnd;) {
+    if ((i + 1 == m_expr[i].iBodyEnd - 1) && ((m_expr[i + 1].keyw == Keyword::VARIABLE) || (m_expr[i + 1].keyw == Keyword::VALUE))) {
+      if (m_expr[i + 1].keyw == Keyword::VARIABLE)
+        emit(OpCode::LOAD_VARIABLE, i + 1);
+      else
+        emitValue(i + 1);
     }
-    if (m_expr[i].keyw == Keyword::OPERATOR) {
-      uint32_t priority = m_uoper[m_expr[i].params].second;
-      size_t iROpr = (i < iEnd - 1) ? i + 1 : size_t(-1);
-      oprs.emplace_back<Operatr>({ i, priority, iLOpr, iROpr });  // inx, priority
+    else {
+      compileExpression(i + 1, m_expr[i].iBodyEnd);
     }
-    iLOpr = i;
-    ++i;
+    emit(OpCode::STORE_RESULT, i);
+    ++argCnt;
+    i = m_expr[i].iBodyEnd;
   }
+  emit(OpCode::CALL_FUNCTION, iExpr, argCnt);
+}
+void Interpreter::Impl::emit(OpCode opc, size_t iExpr, size_t a, size_t b, uint32_t c) {
+  m_code.emplace_back<Instruction>({ opc, c, iExpr, a, b });
+}
+void Interpreter::Impl::emitValue(size_t iExpr) {
+  emit(OpCode::PUSH_VALUE, iExpr, m_const.size());
+  m_const.emplace_back(iExpr != size_t(-1) ? Value(m_expr[iExpr].params) : Value());
+}
 
-  size_t osz = oprs.size();
-  if (osz > 1) {
-    if (osz == 2) {
-      if (oprs[0].priority > oprs[1].priority) swap(oprs[0], oprs[1]);
-    }
-    else if (osz == 3) {
-      if (oprs[0].priority < oprs[1].priority) {
-        if (oprs[2].priority < oprs[0].priority) swap(oprs[0], oprs[2]);
+Interpreter::Impl::Value Interpreter::Impl::runBytecode() {
+
+  const Impl& prog = program();
+
+  m_stack.clear();
+  m_blocks.clear();
+  m_result = Value();
+  m_blockResult.clear();
+  m_exit = false;
+
+  const size_t csz = prog.m_code.size();
+  size_t pc = 0;
+  while (pc < csz) {
+    const Instruction& in = prog.m_code[pc];
+    switch (in.opc) {
+    case OpCode::LOAD_VARIABLE:
+      m_stack.emplace_back(m_var[prog.m_expr[in.iExpr].iVar]);
+      ++pc;
+      break;
+    case OpCode::PUSH_VALUE:
+      m_stack.emplace_back(prog.m_const[in.a]);
+      ++pc;
+      break;
+    case OpCode::PUSH_RESULT:
+      m_stack.emplace_back(m_exprResult[in.iExpr]);
+      ++pc;
+      break;
+    case OpCode::STORE_RESULT:
+      m_exprResult[in.iExpr] = m_stack.back();
+      ++pc;
+      break;
+    case OpCode::CALL_OPERATOR:
+    case OpCode::CALL_OPERATOR_INT: {
+      Value lValue, rValue;
+      const bool lBound = (in.a >= BOUND) && (in.a < OPERAND),
+                 rBound = (in.b >= BOUND) && (in.b < OPERAND);
+      if ((in.b != NO_OPERAND) && !rBound) {
+        rValue = move(m_stack.back());
+        m_stack.pop_back();
       }
-      else {
-        if (oprs[1].priority < oprs[2].priority) swap(oprs[0], oprs[1]);
-        else swap(oprs[0], oprs[2]);
+      if ((in.a != NO_OPERAND) && !lBound) {
+        lValue = move(m_stack.back());
+        m_stack.pop_back();
       }
-      if (oprs[2].priority < oprs[1].priority) swap(oprs[1], oprs[2]);
+      countStep();
+      m_currentIndex = in.iExpr;
+      {
+        ProfileScope ps(*this, in.iExpr);
+        Value& lOpd = lBound ? m_var[prog.m_expr[in.a & ~BOUND].iVar] : lValue;
+        Value& rOpd = rBound ? m_var[prog.m_expr[in.b & ~BOUND].iVar] : rValue;
+        m_exprResult[in.iExpr] = (in.opc == OpCode::CALL_OPERATOR_INT) ? callIntKernel(prog.m_intKernel[in.c], in.iExpr, lOpd, rOpd) :
+                                                                         callOperator(in.iExpr, lOpd, rOpd);
+      }
+      if (in.a < BOUND)
+        m_var[prog.m_expr[in.a].iVar] = move(lValue);
+      ++pc;
     }
-    else if (osz < 10) { // faster than std::sort on small distance
-      for (size_t i = 0; i < osz - 2; ++i) {
-        size_t iMin = i;
-        size_t minPriort = oprs[i].priority;
-        for (size_t j = i + 1; j < osz; ++j) {
-          if (oprs[j].priority < minPriort) {
-            minPriort = oprs[j].priority;
-            iMin = j;
-          }
-        }
-        if (iMin != i) swap(oprs[i], oprs[iMin]);
+      break;
+    case OpCode::CALL_FUNCTION: {
+      ArgScope as(*this);
+      for (auto it = m_stack.end() - in.a; it != m_stack.end(); ++it)
+        as.frame->values.emplace_back(move(*it));
+      m_stack.resize(m_stack.size() - in.a);
+      countStep();
+      m_currentIndex = in.iExpr;
+      {
+        ProfileScope ps(*this, in.iExpr);
+        m_stack.emplace_back(m_exprResult[in.iExpr] = callFunction(in.iExpr, *as.frame));
       }
-      if (oprs[osz - 2].priority > oprs[osz - 1].priority) swap(oprs[osz - 2], oprs[osz - 1]);
+      ++pc;
     }
-    else {
-      sort(oprs.begin(), oprs.end(), [](const Operatr& l, const Operatr& r) {
-        return l.priority < r.priority;
-        });
+      break;
+    case OpCode::STATEMENT:
+      m_exprResult[in.iExpr] = move(m_stack.back());
+      m_stack.pop_back();
+      if (m_blocks.empty())
+        m_result = m_exprResult[in.iExpr];
+      ++pc;
+      if (jumpOnStatementEnd(pc)) return m_result;
+      break;
+    case OpCode::ENTER:
+      m_blocks.emplace_back<Block>({ in.iExpr, pc + 1, in.a, move(m_blockResult) });
+      m_blockResult.clear();
+      if (m_profiling && (prog.m_expr[in.iExpr].keyw == Keyword::WHILE))
+        profileEnter(in.iExpr);
+      if ((in.b != size_t(-1)) ? isTrue(m_exprResult[in.b]) : (prog.m_expr[in.iExpr].keyw != Keyword::IF) && (prog.m_expr[in.iExpr].keyw != Keyword::WHILE))
+        pc = in.a;
+      else
+        ++pc;
+      break;
+    case OpCode::CONDITION:
+      m_exprResult[in.iExpr] = move(m_stack.back());
+      m_stack.pop_back();
+      pc = isTrue(m_exprResult[in.iExpr]) ? pc + 1 : in.a;
+      break;
+    case OpCode::BIND:
+      m_blocks.back().iCondPc = pc + 1;
+      beginBinding(move(m_stack.back()), m_blocks.back().binding);
+      m_stack.pop_back();
+      ++pc;
+      break;
+    case OpCode::ITERATE:
+      m_exprResult[in.iExpr] = nextBinding(in.iExpr, m_blocks.back().binding);
+      pc = isTrue(m_exprResult[in.iExpr]) ? pc + 1 : in.a;
+      break;
+    case OpCode::LOOP:
+      if (countStep() && jumpOnStatementEnd(pc)) return m_result;
+      if (!m_blocks.empty() && (m_blocks.back().iExpr == in.iExpr))
+        pc = m_blocks.back().iCondPc;
+      else
+        ++pc;
+      break;
+    case OpCode::LEAVE:
+      ++pc;
+      if (!m_blocks.empty() && (m_blocks.back().iExpr == in.iExpr)) {
+        leaveBlock();
+        if (jumpOnStatementEnd(pc)) return m_result;
+      }
+      break;
+    case OpCode::BREAK:
+    case OpCode::CONTINUE:
+      if (m_blocks.empty()) {
+        ++pc;
+        break;
+      }
+      if (prog.m_expr[m_blocks.back().iExpr].keyw != Keyword::WHILE)
+        m_blockResult = (in.opc == OpCode::BREAK) ? "break" : "continue";
+      while ((m_blocks.size() > 1) && (prog.m_expr[m_blocks.back().iExpr].keyw != Keyword::WHILE))
+        leaveBlock();
+      if ((in.opc == OpCode::CONTINUE) && (prog.m_expr[m_blocks.back().iExpr].keyw == Keyword::WHILE))
+        pc = m_blocks.back().iCondPc;
+      else
+        pc = m_blocks.back().iEndPc;
+      break;
+    case OpCode::GOTO: {
+      const auto lb = prog.m_label.find(prog.m_expr[in.iExpr].params);
+      if (lb != prog.m_label.end())
+        m_gotoIndex = lb->second;
+      if (m_blocks.empty())
+        m_result = Value();
+      ++pc;
+      if (jumpOnStatementEnd(pc)) return m_result;
+    }
+      break;
     }
   }
+  return m_result;
 }
+void Interpreter::Impl::leaveBlock() {
 
-bool Interpreter::Impl::parseInstructionScript(string& script, size_t gpos) {
+  const Impl& prog = program();
+
+  Block& blk = m_blocks.back();
+  bool isWhile = prog.m_expr[blk.iExpr].keyw == Keyword::WHILE;
+  if (m_blocks.size() == 1)
+    m_result = m_blockResult;
+  if (isWhile)
+    m_blockResult = move(blk.result);
+  if (m_profiling && isWhile)
+    profileLeave(blk.iExpr);
+  m_blocks.pop_back();
+}
+bool Interpreter::Impl::jumpOnStatementEnd(size_t& pc) {
+
+  const Impl& prog = program();
+
+  if (m_exit) {
+    m_gotoIndex = size_t(-1);
+    while (!m_blocks.empty())
+      leaveBlock();
+    return true;
+  }
+  if (m_gotoIndex != size_t(-1)) {
+    size_t iGoto = m_gotoIndex;
+    m_gotoIndex = size_t(-1);
+    if ((iGoto < prog.m_exprPc.size()) && (prog.m_exprPc[iGoto] != size_t(-1))) {
+      while (!m_blocks.empty()) {
+        const auto& ex = prog.m_expr[m_blocks.back().iExpr];
+        if ((ex.iConditionEnd <= iGoto) && (iGoto < ex.iBodyEnd))
+          break;
+        leaveBlock();
+      }
+      pc = prog.m_exprPc[iGoto];
+    }
+  }
+  return false;
+}
+
+bool Interpreter::Impl::parseInstructionScript(string_view script, size_t gpos) {
 
   size_t iExpr = m_expr.size(),
          cpos = 0;
 
 #define CHECK_PARSE_RETURN(condition)                                                                                                     \
     if (condition){                                                                                                                       \
-        if (m_err.empty()) m_err = "Error script pos " + to_string(cpos + gpos) + " src line " + to_string(__LINE__) + ": " + #condition; \
+        if (m_err.empty()) m_err = "Error script pos " + to_string(sourcePosition(cpos + gpos)) + " src line " + to_string(__LINE__) + ": " + #condition; \
         return false;                                                                                                                     \
     }
 #define SPARE_SYMBOL_CONTINUE                                                                       \
@@ -692,13 +2679,13 @@ bool Interpreter::Impl::parseInstructionScript(string& script, size_t gpos) {
     if (!getFunctionAtFirst(script, cposFunc).empty() || !getOperatorAtFirst(script, cposOpr).empty()) {
         m_expr.emplace_back<Expression>({ Keyword::EXPRESSION, iExpr, iExpr, size_t(-1) });
 
-        string expr = getNextParam(script, cpos, ';');
+        string_view expr = getNextParam(script, cpos, ';');
         CHECK_PARSE_RETURN(expr.empty() || !parseExpressionScript(expr, gpos + cpos - expr.size() - 1));
 
         iExpr = m_expr[iExpr].iBodyEnd = m_expr.size();
     }     
     else if (startWith(script, cpos, "while") || startWith(script, cpos, "if") || startWith(script, cpos, "elseif")) {
-      const string kname = getNextParam(script, cpos, '(');
+      const string_view kname = getNextParam(script, cpos, '(');
       CHECK_PARSE_RETURN(kname.empty());
 
       Keyword keyw = keywordByName(kname);
@@ -713,18 +2700,19 @@ bool Interpreter::Impl::parseInstructionScript(string& script, size_t gpos) {
       }
 
       --cpos;
-      string condition = getIntroScript(script, cpos, '(', ')');
+      string_view condition = getIntroScript(script, cpos, '(', ')');
       CHECK_PARSE_RETURN(condition.empty() || !parseExpressionScript(condition, gpos + cpos - condition.size() - 2));
 
       m_expr[iExpr].iConditionEnd = m_expr.size();
 
       if (script[cpos] == '{') {
-        string body = getIntroScript(script, cpos, '{', '}');
+        string_view body = getIntroScript(script, cpos, '{', '}');
         CHECK_PARSE_RETURN(body.empty() || !parseInstructionScript(body, gpos + cpos - body.size() - 2));
       }
       else {
-        string body = getNextParam(script, cpos, ';') + ';';
-        CHECK_PARSE_RETURN((body.size() == 1) || !parseInstructionScript(body, gpos + cpos - body.size()));
+        const size_t cposBody = cpos;  // the body is taken with ';'
+        string_view body = getNextParam(script, cpos, ';');
+        CHECK_PARSE_RETURN(body.empty() || !parseInstructionScript(script.substr(cposBody, body.size() + 1), gpos + cposBody));
       }
       iExpr = m_expr[iExpr].iBodyEnd = m_expr.size();
 
@@ -738,12 +2726,13 @@ bool Interpreter::Impl::parseInstructionScript(string& script, size_t gpos) {
       m_expr[iExpr].params = to_string(iIF);
 
       if (script[cpos] == '{') {
-        string body = getIntroScript(script, cpos, '{', '}');
+        string_view body = getIntroScript(script, cpos, '{', '}');
         CHECK_PARSE_RETURN(body.empty() || !parseInstructionScript(body, gpos + cpos - body.size() - 2));
       }
       else {
-        string body = getNextParam(script, cpos, ';') + ';';
-        CHECK_PARSE_RETURN((body.size() == 1) || !parseInstructionScript(body, gpos + cpos - body.size()));
+        const size_t cposBody = cpos;  // the body is taken with ';'
+        string_view body = getNextParam(script, cpos, ';');
+        CHECK_PARSE_RETURN(body.empty() || !parseInstructionScript(script.substr(cposBody, body.size() + 1), gpos + cposBody));
       }
       m_expr[iExpr].iConditionEnd = iExpr + 1;
       iExpr = m_expr[iExpr].iBodyEnd = m_expr.size();
@@ -751,44 +2740,16 @@ bool Interpreter::Impl::parseInstructionScript(string& script, size_t gpos) {
       if ((cpos < script.size()) && (script[cpos] == ';')) ++cpos;
     }
     else if (startWith(script, cpos, "break") || startWith(script, cpos, "continue")) {
-      const string kname = getNextParam(script, cpos, ';');
+      const string_view kname = getNextParam(script, cpos, ';');
       CHECK_PARSE_RETURN(kname.empty());
       const Keyword keyw = keywordByName(kname);
 
       m_expr.emplace_back<Expression>({ keyw, iExpr, iExpr, size_t(-1) });
       ++iExpr;
     }
-    else if (startWith(script, cpos, "#macro")) {  // macro declaration
-      cpos += 6;
-      const string mname = getNextParam(script, cpos, '{');
-
-      cpos -= 1;
-      const string mvalue = getIntroScript(script, cpos, '{', '}');
-      CHECK_PARSE_RETURN(mname.empty() || mvalue.empty());
-
-      m_macro["#" + mname] = mvalue;
-
-      if ((cpos < script.size()) && (script[cpos] == ';')) ++cpos;
-    }
-    else if (script[cpos] == '#') {               // macro definition
-      size_t cposMName = cpos;
-      const string mname = getMacroAtFirst(script, cposMName);
-      CHECK_PARSE_RETURN(mname.empty() || (m_macro.find(mname) == m_macro.end()));
-
-      size_t cposArg = cposMName;
-      const string args = getIntroScript(script, cposArg, '(', ')');
-      string macro = m_macro[mname];
-      if (!args.empty())
-        CHECK_PARSE_RETURN(!parseMacroArgs(args, macro));
-      
-      if (cposArg == cposMName)
-        script.replace(cpos, mname.size(), macro);
-      else
-        script.replace(cpos, (mname + "(" + args + ")").size(), macro);
-    }
     else if (startWith(script, cpos, "goto")) {
       cpos += 4;
-      const string lname = getNextParam(script, cpos, ';');
+      const string lname(getNextParam(script, cpos, ';'));
       CHECK_PARSE_RETURN(lname.empty());
 
       if (m_label.find(lname) == m_label.end())
@@ -798,31 +2759,43 @@ bool Interpreter::Impl::parseInstructionScript(string& script, size_t gpos) {
       ++iExpr;
     }
     else if (startWith(script, cpos, "l_")) {
-      const string lname = getNextParam(script, cpos, ':');
+      const string lname(getNextParam(script, cpos, ':'));
       CHECK_PARSE_RETURN(lname.empty());
 
       m_label[lname] = iExpr;
     }
     else if (startWith(script, cpos, "function")) {
       cpos += 8;
-      const string fname = getNextParam(script, cpos, '{');
+      const string fname(getNextParam(script, cpos, '{'));
       CHECK_PARSE_RETURN(fname.empty());
 
       cpos -= 1;
-      const string fbody = getIntroScript(script, cpos, '{', '}');
+      const string_view fbody = getIntroScript(script, cpos, '{', '}');
       CHECK_PARSE_RETURN(fbody.empty());
 
-      Interpreter::Impl fImpl = *this;
-      fImpl.m_internFunc[fname] = {};
-
-      CHECK_PARSE_RETURN(!fImpl.parseScript(fbody, m_err));
-
-      m_internFunc[fname] = fImpl;
+      // the body is parsed on the registries of interpreter, they are shared until a change
+      auto fImpl = make_shared<Impl>();
+      fImpl->m_reg = m_reg;
+      fImpl->m_bytecode = m_bytecode;
+      fImpl->m_optimize = m_optimize;
+      fImpl->m_cache.capacity = 0;
+      fImpl->m_funcName = fname;
+      fImpl->m_declarer = this;
+      fImpl->setInternFunction(fname, nullptr);
+
+      const bool isParsed = fImpl->parseScript(string(fbody), m_err);
+      fImpl->m_declarer = nullptr;
+      CHECK_PARSE_RETURN(!isParsed);
+      fImpl->resolveArguments();
+
+      setInternFunction(fname, fImpl);
+      if (m_cache.capacity > 0)
+        m_parseEffects.internFunc[fname] = make_shared<Impl>(*fImpl);
     }
     else {
       m_expr.emplace_back<Expression>({ Keyword::EXPRESSION, iExpr, iExpr, size_t(-1) });
 
-      string expr = getNextParam(script, cpos, ';');
+      string_view expr = getNextParam(script, cpos, ';');
       CHECK_PARSE_RETURN(expr.empty() || !parseExpressionScript(expr, gpos + cpos - expr.size() - 1));
 
       iExpr = m_expr[iExpr].iBodyEnd = m_expr.size();
@@ -830,7 +2803,7 @@ bool Interpreter::Impl::parseInstructionScript(string& script, size_t gpos) {
   }
   return true;
 }
-bool Interpreter::Impl::parseExpressionScript(string& script, size_t gpos) {
+bool Interpreter::Impl::parseExpressionScript(string_view script, size_t gpos) {
 
   size_t iExpr = m_expr.size(),
          cpos = 0;
@@ -857,51 +2830,55 @@ bool Interpreter::Impl::parseExpressionScript(string& script, size_t gpos) {
         bodyEndSym = ']';
       }
       if ((!oprName.empty() && (bodyBegin < cpos)) || (oprName.empty() && (bodyBegin != string::npos))) {
-        const string vName = script.substr(posmem, bodyBegin - posmem);
-        string value = getIntroScript(script, bodyBegin, bodyBeginSym, bodyEndSym);
+        const string vName(script.substr(posmem, bodyBegin - posmem));
+        const string_view index = getIntroScript(script, bodyBegin, bodyBeginSym, bodyEndSym);
+        string value(index);
         if (!value.empty()) {
           if (value[0] == '"') 
             value = value.substr(1);
           if (!value.empty() && (value.back() == '"'))
             value.pop_back();
         }
-        m_expr.emplace_back<Expression>({ Keyword::VARIABLE, iExpr, iExpr, size_t(-1), vName, value }); ++iExpr;
+        size_t iVar = variableSlot(vName);
+        m_expr.emplace_back<Expression>({ Keyword::VARIABLE, iExpr, iExpr, size_t(-1), vName, value, iVar }); ++iExpr;
         if (oprName == "[" && bodyBeginSym == '['){
           m_expr.emplace_back<Expression>({ Keyword::OPERATOR, iExpr, iExpr, size_t(-1), oprName }); ++iExpr;
-          m_expr.emplace_back<Expression>({ Keyword::VALUE, iExpr, iExpr, size_t(-1), vName, value }); ++iExpr;
+          CHECK_PARSE_RETURN(!parseIndexScript(index, gpos + bodyBegin - index.size() - 1));
+          iExpr = m_expr.size();
         }
-        m_var[vName] = value;
+        m_var[iVar] = value;
+        m_parseEffects.varInit.emplace_back(iVar, value);
 
         cpos = bodyBegin;
       }
       else if (!oprName.empty()) {
-        string vName = script.substr(posmem, cpos - posmem - oprName.size());
-        if (m_var.find(vName) == m_var.end())
-          m_var.insert({ vName, "" });
+        const string vName(script.substr(posmem, cpos - posmem - oprName.size()));
+        size_t iVar = variableSlot(vName);
 
-        m_expr.emplace_back<Expression>({ Keyword::VARIABLE, iExpr, iExpr, size_t(-1), vName }); ++iExpr;
+        m_expr.emplace_back<Expression>({ Keyword::VARIABLE, iExpr, iExpr, size_t(-1), vName, Value(), iVar }); ++iExpr;
         m_expr.emplace_back<Expression>({ Keyword::OPERATOR, iExpr, iExpr, size_t(-1), oprName }); ++iExpr;
       }
       else {        
-        string vName = script.substr(cpos);
+        string vName(script.substr(cpos));
 
         if (vName.back() == ';') vName.pop_back();
 
-        if (m_var.find(vName) == m_var.end())
-          m_var.insert({ vName, "" });
+        size_t iVar = variableSlot(vName);
 
-        m_expr.emplace_back<Expression>({ Keyword::VARIABLE, iExpr, iExpr, size_t(-1), vName });
+        m_expr.emplace_back<Expression>({ Keyword::VARIABLE, iExpr, iExpr, size_t(-1), vName, Value(), iVar });
         
         break;
       }
     }
     else if (!(fName = getFunctionAtFirst(script, cpos)).empty()) {
-      CHECK_PARSE_RETURN(!m_ufunc.count(fName) && !m_internFunc.count(fName));
+      CHECK_PARSE_RETURN(!m_reg->ufunc.count(fName) && !m_reg->ufuncView.count(fName) && !isInternFunction(fName));
+      if (!m_internFunc.count(fName) && isInternFunction(fName))
+        m_internFunc.emplace(fName, nullptr);  // function of declarer, is resolved on call
 
       m_expr.emplace_back<Expression>({ Keyword::FUNCTION, iExpr, iExpr, size_t(-1), fName });
 
       size_t cposMem = cpos;
-      string args = getIntroScript(script, cpos, '(', ')');
+      string_view args = getIntroScript(script, cpos, '(', ')');
       CHECK_PARSE_RETURN(args.empty() && (cposMem + 2 != cpos));
       if (!args.empty())
         CHECK_PARSE_RETURN(!parseArgumentScript(args, gpos + cpos - args.size() - 2));
@@ -911,7 +2888,7 @@ bool Interpreter::Impl::parseExpressionScript(string& script, size_t gpos) {
       if ((cpos < script.size()) && (script[cpos] == ';')) ++cpos;
     }
     else if (script[cpos] == '(') {
-      string expr = getIntroScript(script, cpos, '(', ')');
+      string_view expr = getIntroScript(script, cpos, '(', ')');
 
       m_expr.emplace_back<Expression>({ Keyword::EXPRESSION, iExpr, iExpr, size_t(-1) });
 
@@ -921,35 +2898,19 @@ bool Interpreter::Impl::parseExpressionScript(string& script, size_t gpos) {
 
       if ((cpos < script.size()) && (script[cpos] == ';')) ++cpos;
     }
-    else if (script[cpos] == '#') {
-      size_t cposMName = cpos;
-      const string mname = getMacroAtFirst(script, cposMName);
-      CHECK_PARSE_RETURN(mname.empty() || (m_macro.find(mname) == m_macro.end()));
-
-      size_t cposArg = cposMName;
-      const string args = getIntroScript(script, cposArg, '(', ')');
-      string macro = m_macro[mname];
-      if (!args.empty())
-        CHECK_PARSE_RETURN(!parseMacroArgs(args, macro));
-
-      if (cposArg == cposMName)
-          script.replace(cpos, mname.size(), macro);
-      else
-          script.replace(cpos, (mname + "(" + args + ")").size(), macro);
-    }
     else if (!(oprName = getOperatorAtFirst(script, cpos)).empty()) {
-      CHECK_PARSE_RETURN(m_uoper.find(oprName) == m_uoper.end());
+      CHECK_PARSE_RETURN(m_reg->uoper.find(oprName) == m_reg->uoper.end());
 
       m_expr.emplace_back<Expression>({ Keyword::OPERATOR, iExpr, iExpr, size_t(-1), oprName }); ++iExpr;
     }
     else {  // value
       if (script[cpos] == '"') {
         ++cpos;
-        const string vName = getNextParam(script, cpos, '"');
+        const string vName(getNextParam(script, cpos, '"'));
         m_expr.emplace_back<Expression>({ Keyword::VALUE, iExpr, iExpr, size_t(-1), vName }); ++iExpr;
       }
       else if (script[cpos] == '{') {
-        const string value = getIntroScript(script, cpos, '{', '}');
+        const string value(getIntroScript(script, cpos, '{', '}'));
         m_expr.emplace_back<Expression>({ Keyword::VALUE, iExpr, iExpr, size_t(-1), "", value }); ++iExpr; // empty name
       }
       else {
@@ -966,23 +2927,24 @@ bool Interpreter::Impl::parseExpressionScript(string& script, size_t gpos) {
           bodyEndSym = ']';
         }
         if ((!oprName.empty() && (bodyBegin < cpos)) || (oprName.empty() && (bodyBegin != string::npos))) {
-          const string vName = script.substr(posmem, bodyBegin - posmem);         
-          const string value = getIntroScript(script, bodyBegin, bodyBeginSym, bodyEndSym);
-          m_expr.emplace_back<Expression>({ Keyword::VALUE, iExpr, iExpr, size_t(-1), vName, value }); ++iExpr;
+          const string vName(script.substr(posmem, bodyBegin - posmem));
+          const string_view value = getIntroScript(script, bodyBegin, bodyBeginSym, bodyEndSym);
+          m_expr.emplace_back<Expression>({ Keyword::VALUE, iExpr, iExpr, size_t(-1), vName, string(value) }); ++iExpr;
           if (oprName == "[" && bodyBeginSym == '['){
             m_expr.emplace_back<Expression>({ Keyword::OPERATOR, iExpr, iExpr, size_t(-1), oprName }); ++iExpr;
-            m_expr.emplace_back<Expression>({ Keyword::VALUE, iExpr, iExpr, size_t(-1), vName, value }); ++iExpr;
+            CHECK_PARSE_RETURN(!parseIndexScript(value, gpos + bodyBegin - value.size() - 1));
+            iExpr = m_expr.size();
           }
           cpos = bodyBegin;
         }
         else if (!oprName.empty()) {
-          const string vName = script.substr(posmem, cpos - posmem - oprName.size());
+          const string vName(script.substr(posmem, cpos - posmem - oprName.size()));
 
           m_expr.emplace_back<Expression>({ Keyword::VALUE, iExpr, iExpr, size_t(-1), vName }); ++iExpr;
           m_expr.emplace_back<Expression>({ Keyword::OPERATOR, iExpr, iExpr, size_t(-1), oprName }); ++iExpr;
         }
         else {
-          string vName = script.substr(cpos);
+          string vName(script.substr(cpos));
 
           if (vName.back() == ';') vName.pop_back();
 
@@ -994,22 +2956,38 @@ bool Interpreter::Impl::parseExpressionScript(string& script, size_t gpos) {
   }
   return true;
 }
-bool Interpreter::Impl::parseArgumentScript(string& script, size_t gpos) {
+bool Interpreter::Impl::parseIndexScript(string_view index, size_t gpos) {
+
+  // the index is calculated by the run and is the right operand of '[',
+  // the left operand keeps the text of index
+  if (index.empty()) {
+    m_expr.emplace_back<Expression>({ Keyword::VALUE, m_expr.size(), m_expr.size(), size_t(-1), "" });
+    return true;
+  }
+  size_t iExpr = m_expr.size();
+  m_expr.emplace_back<Expression>({ Keyword::EXPRESSION, iExpr, iExpr, size_t(-1) });
+  if (!parseExpressionScript(index, gpos))
+    return false;
+  m_expr[iExpr].iBodyEnd = m_expr.size();
+  return true;
+}
+bool Interpreter::Impl::parseArgumentScript(string_view script, size_t gpos) {
 
   size_t iExpr = m_expr.size(),
          cpos = 0,
          cp = 0;
-  int bordCnt = 0;
 
   while (cp < script.size()) {
-    if (script[cp] == '(') ++bordCnt;
-    if (script[cp] == ')') --bordCnt;
-    if (((script[cp] == ',') || (cp == script.size() - 1)) && (bordCnt == 0)) {
+    if (script[cp] == '(') {  // the commas of nested calls are skipped
+      cp = closingBracket(script, cp, '(', ')');
+      if (cp == string::npos) break;
+    }
+    if ((script[cp] == ',') || (cp == script.size() - 1)) {
       m_expr.emplace_back<Expression>({ Keyword::ARGUMENT, iExpr, iExpr, size_t(-1) });
 
       if (cp == script.size() - 1) ++cp;
 
-      string arg = script.substr(cpos, cp - cpos);
+      string_view arg = script.substr(cpos, cp - cpos);
       CHECK_PARSE_RETURN(!arg.empty() && !parseExpressionScript(arg, gpos + cpos));
 
       iExpr = m_expr[iExpr].iBodyEnd = m_expr.size();
@@ -1019,129 +2997,195 @@ bool Interpreter::Impl::parseArgumentScript(string& script, size_t gpos) {
   }
   return true;
 }
-bool Interpreter::Impl::parseMacroArgs(const string& args, string& macro) {
+Interpreter::Impl::Macro Interpreter::Impl::compileMacro(const string& body) const {
+
+  // the body is split once by placeholders of arguments $0, $1, ..
+  Macro macro{ body, {} };
+  const size_t ssz = body.size();
+  string text;
+  for (size_t cp = 0; cp < ssz; ++cp) {
+    size_t cpEnd = cp + 1;
+    while ((body[cp] == '$') && (cpEnd < ssz) && (cpEnd - cp < 10) && isdigit((unsigned char)body[cpEnd]))
+      ++cpEnd;
+    if (cpEnd - cp > 1) {
+      const string placeholder = body.substr(cp, cpEnd - cp);
+      macro.part.emplace_back<MacroPart>({ move(text), stoul(placeholder.substr(1)), placeholder });
+      text.clear();
+      cp = cpEnd - 1;
+    }
+    else
+      text += body[cp];
+  }
+  macro.part.emplace_back<MacroPart>({ move(text), size_t(-1), "" });
+  return macro;
+}
+vector<string> Interpreter::Impl::splitMacroArgs(const string& args) const {
 
+  vector<string> res;
   size_t ssz = args.size(),
-         cpos = 0,
-         cp = 0;
+         cpos = 0;
   int bordCnt = 0;
-  int argIndex = 0;
-
-  while (cp < ssz) {
+  for (size_t cp = 0; cp < ssz; ++cp) {
     if (args[cp] == '(') ++bordCnt;
     if (args[cp] == ')') --bordCnt;
-    if (((args[cp] == ',') || (cp == ssz - 1)) && (bordCnt == 0)) {
-     
-      if (cp == ssz - 1) ++cp;
-
-      const string arg = args.substr(cpos, cp - cpos);
-      
-      size_t argPos = 0;
-      argPos = macro.find("$" + to_string(argIndex), argPos);
-      while (argPos != string::npos) {
-      
-        macro.replace(argPos, ("$" + to_string(argIndex)).size(), arg);
-
-        argPos = macro.find("$" + to_string(argIndex), argPos);
-      }
-
+    if ((args[cp] == ',') && (bordCnt == 0)) {
+      res.push_back(args.substr(cpos, cp - cpos));
       cpos = cp + 1;
-      ++argIndex;
     }
-    ++cp;
   }
+  if (cpos < ssz)
+    res.push_back(args.substr(cpos));
+  return res;
+}
+bool Interpreter::Impl::expandMacros(string& script, vector<size_t>& ioSrcPos) {
+
+  m_macroExpandedSize = script.size();
+  if (script.find('#') == string::npos)
+    return true;
+
+  string expanded;
+  vector<size_t> srcPos;
+  if (!expandMacroScript(script, 0, 0, expanded, &ioSrcPos, &srcPos))
+    return false;
+  script = move(expanded);
+  ioSrcPos = move(srcPos);
+  m_macroExpandedSize = script.size();
+  return true;
+}
+bool Interpreter::Impl::expandMacroScript(const string& script, size_t depth, size_t usePos, string& outScript,
+                                          const vector<size_t>* srcPos, vector<size_t>* outSrcPos) {
+
+  // one pass before parsing: macro declarations are taken, macro uses are replaced by bodies with arguments.
+  // The expanded body is expanded again (macros in macro) and is kept by name and arguments.
+  // The body of macro has no source positions, usePos is the position of the outer use
+  size_t cpos = 0;
+  auto sourcePos = [srcPos, depth, usePos, &cpos]() {
+    if (depth > 0) return usePos;
+    return (srcPos && (cpos < srcPos->size())) ? (*srcPos)[cpos] : cpos;
+  };
+  auto copyTo = [&](size_t cpEnd) {
+    outScript.append(script, cpos, cpEnd - cpos);
+    for (; outSrcPos && (cpos < cpEnd); ++cpos)
+      outSrcPos->push_back(sourcePos());
+    cpos = cpEnd;
+  };
+  auto append = [&outScript, outSrcPos](const string& text, size_t pos) {
+    outScript += text;
+    if (outSrcPos) outSrcPos->insert(outSrcPos->end(), text.size(), pos);
+  };
+
+#define CHECK_MACRO_RETURN(condition)                                                                                               \
+    if (condition){                                                                                                                  \
+        if (m_err.empty()) m_err = "Error script pos " + to_string(sourcePos()) + " src line " + to_string(__LINE__) + ": " + #condition; \
+        return false;                                                                                                                \
+    }
+
+  CHECK_MACRO_RETURN(depth > MAX_MACRO_DEPTH);
+
+  const size_t ssz = script.size();
+  while (cpos < ssz) {
+    copyTo(std::min(script.find_first_of("#\"", cpos), ssz));
+    if (cpos == ssz) break;
+
+    if (script[cpos] == '"') {  // string value as is
+      copyTo(std::min(script.find('"', cpos + 1), ssz - 1) + 1);
+    }
+    else if (startWith(script, cpos, "#macro")) {  // macro declaration
+      size_t cp = cpos + 6;
+      const string mname(getNextParam(script, cp, '{'));
+
+      cp -= 1;
+      const string mvalue(getIntroScript(script, cp, '{', '}'));
+      CHECK_MACRO_RETURN(mname.empty() || mvalue.empty());
+
+      setMacroScript("#" + mname, mvalue);
+      m_parseEffects.macro.emplace_back("#" + mname, mvalue);
+
+      if ((cp < ssz) && (script[cp] == ';')) ++cp;
+      cpos = cp;
+    }
+    else {                                         // macro definition
+      size_t cposMName = cpos;
+      const string mname = getMacroAtFirst(script, cposMName);
+      CHECK_MACRO_RETURN(mname.empty() || (m_reg->macro.find(mname) == m_reg->macro.end()));
+
+      size_t cposArg = cposMName;
+      const string args(getIntroScript(script, cposArg, '(', ')'));
+      const string key = script.substr(cpos, cposArg - cpos);
+
+      const size_t useBegin = m_macroUse.size();
+      m_macroUse.push_back(mname);
+      auto itExp = m_macroExpansion.find(key);
+      if (itExp == m_macroExpansion.end()) {
+        const vector<string> argValues = splitMacroArgs(args);
+        string body;
+        for (const auto& part : m_reg->macro.find(mname)->second.part) {
+          body += part.text;
+          if (part.iArg != size_t(-1))
+            body += part.iArg < argValues.size() ? argValues[part.iArg] : part.placeholder;
+        }
+        string expanded;
+        CHECK_MACRO_RETURN(!expandMacroScript(body, depth + 1, sourcePos(), expanded, nullptr, nullptr));
+
+        if (body.find("#macro") != string::npos) {  // the declaration must be taken on every use
+          append(expanded, sourcePos());
+          cpos = cposArg;
+          continue;
+        }
+        if (m_macroExpansion.size() >= MAX_MACRO_EXPANSIONS)
+          m_macroExpansion.clear();
+        vector<string> macroUse(m_macroUse.begin() + useBegin, m_macroUse.end());
+        itExp = m_macroExpansion.emplace(key, MacroExpansion{ move(expanded), move(macroUse) }).first;
+      }
+      else
+        m_macroUse.insert(m_macroUse.end(), itExp->second.macroUse.begin() + 1, itExp->second.macroUse.end());
+      append(itExp->second.text, sourcePos());
+      cpos = cposArg;
+    }
+  }
+#undef CHECK_MACRO_RETURN
+
   return true;
 }
 
-string Interpreter::Impl::getNextParam(const string& script, size_t& cpos, char symb) const {
+string_view Interpreter::Impl::getNextParam(string_view script, size_t& cpos, char symb) const {
   size_t pos = script.find(symb, cpos);
-  string res;
+  string_view res;
   if (pos != string::npos) {
     res = script.substr(cpos, pos - cpos);
     cpos = pos + 1;
   }
   return res;
 }
-string Interpreter::Impl::getNextOperator(const string& script, size_t& cpos) const {
-  size_t minp = string::npos;
+string Interpreter::Impl::getNextOperator(string_view script, size_t& cpos) const {
   string opr;
-  for (const auto& op : m_uoper) {
-    size_t pos = script.find(op.first, cpos);
-    if ((pos != string::npos) && ((pos <= minp) || (minp == string::npos))) {
-      if (opr.empty() || (pos < minp) || (opr.size() < op.first.size()))
-        opr = op.first;
-      minp = pos;
+  for (size_t pos = cpos; pos < script.size(); ++pos) {
+    if (!(opr = m_reg->uoperNames.match(script, pos)).empty()) {
+      cpos = pos;
+      break;
     }
   }
-  if (minp != string::npos) {
-    cpos = minp + opr.size();
-  }
   return opr;
 }
-string Interpreter::Impl::getOperatorAtFirst(const string& script, size_t& cpos) const {
-  string opr;
-  for (const auto& op : m_uoper) {
-    if (startWith(script, cpos, op.first)) {
-      if (opr.empty() || (opr.size() < op.first.size()))
-        opr = op.first;
-    }
-  }
-  cpos += opr.size();
-  return opr;
+string Interpreter::Impl::getOperatorAtFirst(string_view script, size_t& cpos) const {
+  return m_reg->uoperNames.match(script, cpos);
 }
-string Interpreter::Impl::getFunctionAtFirst(const string& script, size_t& cpos) const {
-  string fName;
-  for (const auto& f : m_ufunc) {
-    if (startWith(script, cpos, f.first)) {
-      if (fName.empty() || (fName.size() < f.first.size()))
-        fName = f.first;
-    }
-  }
-  if (fName.empty()){
-    for (const auto& f : m_internFunc) {
-      if (startWith(script, cpos, f.first)) {
-        if (fName.empty() || (fName.size() < f.first.size()))
-          fName = f.first;
-      }
-    }
-  }
-  cpos += fName.size();
+string Interpreter::Impl::getFunctionAtFirst(string_view script, size_t& cpos) const {
+  string fName = m_reg->ufuncNames.match(script, cpos);
+  for (const Impl* impl = this; fName.empty() && impl; impl = impl->m_declarer)
+    fName = impl->m_internFuncNames.match(script, cpos);
   return fName;
 }
-string Interpreter::Impl::getMacroAtFirst(const string& script, size_t& cpos) const {
-  string mName;
-  for (const auto& m : m_macro) {
-    if (startWith(script, cpos, m.first)) {
-      if (mName.empty() || (mName.size() < m.first.size()))
-        mName = m.first;
-    }
-  }
-  cpos += mName.size();
-  return mName;
+string Interpreter::Impl::getMacroAtFirst(string_view script, size_t& cpos) const {
+  return m_reg->macroNames.match(script, cpos);
 }
-string Interpreter::Impl::getAttributeAtFirst(const string& script, size_t& cpos) const {
-  string mName;
-  for (const auto& m : m_attribute) {
-    if (startWith(script, cpos, m)) {
-      if (mName.empty() || (mName.size() < m.size()))
-        mName = m;
-    }
-  }
-  cpos += mName.size();
-  return mName;
+string Interpreter::Impl::getAttributeAtFirst(string_view script, size_t& cpos) const {
+  return m_reg->attributeNames.match(script, cpos);
 }
-string Interpreter::Impl::getIntroScript(const string& script, size_t& cpos, char symbBegin, char symbEnd) const {
-  size_t ssz = script.size(),
-    cp = cpos;
-  int bordCnt = 0;
-  while (cp < ssz) {
-    if (script[cp] == symbBegin) ++bordCnt;
-    if (script[cp] == symbEnd) --bordCnt;
-    if (bordCnt == 0) break;
-    ++cp;
-  }
-  string res;
-  if ((bordCnt == 0) && (cp > cpos)) {
+string_view Interpreter::Impl::getIntroScript(string_view script, size_t& cpos, char symbBegin, char symbEnd) const {
+  const size_t cp = closingBracket(script, cpos, symbBegin, symbEnd);
+  string_view res;
+  if ((cp != string::npos) && (cp > cpos)) {
     res = script.substr(cpos + 1, cp - cpos - 1);
     cpos = cp + 1;
   }
@@ -1159,8 +3203,8 @@ bool Interpreter::Impl::isFindKeySymbol(const string& script, size_t cpos, size_
     (script.find('"', cpos) < maxpos) ||
     (script.find('$', cpos) < maxpos);
 }
-bool Interpreter::Impl::startWith(const string& str, size_t pos, const string& begin) const {
-  return (str.find(begin, pos) - pos) == 0;
+bool Interpreter::Impl::startWith(string_view str, size_t pos, const string& begin) const {
+  return (pos <= str.size()) && (str.compare(pos, begin.size(), begin) == 0);
 }
 bool Interpreter::Impl::isNumber(const string& s) const {
   for (auto c : s) {
@@ -1170,7 +3214,21 @@ bool Interpreter::Impl::isNumber(const string& s) const {
   }
   return !s.empty();
 }
-Interpreter::Impl::Keyword Interpreter::Impl::keywordByName(const string& oprName) const {
+bool Interpreter::Impl::isArgument(const string& vname) const {
+  return (vname.size() > 1) && (vname.size() < 10) && (vname[0] == '$') && isNumber(vname.substr(1));
+}
+bool Interpreter::Impl::isTrue(const string& condn) const {
+  bool isNum = isNumber(condn);
+  return (isNum && (stoi(condn) != 0)) || (!isNum && !condn.empty());
+}
+bool Interpreter::Impl::isTrue(const Value& condn) const {
+  switch (condn.type()) {
+  case Value::Type::NONE: return false;
+  case Value::Type::INT:  return condn.toInt() != 0;
+  default:                return isTrue(condn.str());
+  }
+}
+Interpreter::Impl::Keyword Interpreter::Impl::keywordByName(string_view oprName) const {
   Keyword nextOpr = Keyword::INSTRUCTION;
   if (oprName == "if") nextOpr = Keyword::IF;
   else if (oprName == "else") nextOpr = Keyword::ELSE;
@@ -1201,6 +3259,69 @@ Interpreter::EntityType Interpreter::Impl::keywordToEntityType(Keyword keyw) con
   }  
 }
 
+void Interpreter::Impl::NameTrie::insert(const string& name) {
+  size_t node = 0;
+  for (char c : name) {
+    auto it = m_nodes[node].next.find(c);
+    if (it == m_nodes[node].next.end()) {
+      m_nodes[node].next.emplace(c, m_nodes.size());
+      node = m_nodes.size();
+      m_nodes.emplace_back();
+    }
+    else node = it->second;
+  }
+  m_nodes[node].isEnd = true;
+}
+string Interpreter::Impl::NameTrie::match(string_view str, size_t& cpos) const {
+  size_t node = 0, len = 0;
+  for (size_t i = cpos; i < str.size(); ++i) {
+    auto it = m_nodes[node].next.find(str[i]);
+    if (it == m_nodes[node].next.end()) break;
+    node = it->second;
+    if (m_nodes[node].isEnd) len = i - cpos + 1;
+  }
+  string name(str.substr(min(cpos, str.size()), len));
+  cpos += len;
+  return name;
+}
+Interpreter::Impl::Value::Value(string s) :
+  m_type(Type::STRING),
+  m_hasStr(true),
+  m_str(move(s)) {
+
+  // canonical decimal integer only, so that str() gives back the same text
+  const size_t ssz = m_str.size(),
+               iDigit = (ssz > 1) && (m_str[0] == '-') ? 1 : 0;
+  if ((ssz == 0) || (ssz - iDigit > 18) || ((m_str[iDigit] == '0') && (ssz > 1)))
+    return;
+  int64_t v = 0;
+  for (size_t i = iDigit; i < ssz; ++i) {
+    if (!std::isdigit(m_str[i])) return;
+    v = v * 10 + (m_str[i] - '0');
+  }
+  m_type = Type::INT;
+  m_int = iDigit ? -v : v;
+}
+const string& Interpreter::Impl::Value::str() const {
+  if (!m_hasStr) {
+    char buff[32];
+    if (m_type == Type::INT)
+      m_str.assign(buff, to_chars(buff, buff + sizeof(buff), m_int).ptr);
+    else if (m_type == Type::DOUBLE)
+      m_str.assign(buff, to_chars(buff, buff + sizeof(buff), m_dbl).ptr);
+    else
+      m_str.clear();
+    m_hasStr = true;
+  }
+  return m_str;
+}
+string Interpreter::Impl::Value::release() {
+  str();
+  m_type = Type::NONE;
+  m_hasStr = false;
+  return move(m_str);
+}
+
 Interpreter::Interpreter() {
   m_d = new Interpreter::Impl();
 }
@@ -1209,15 +3330,19 @@ Interpreter::~Interpreter() {
 }
 Interpreter::Interpreter(const Interpreter& other) {
   m_d = new Interpreter::Impl();
-  if (other.m_d)
+  if (other.m_d) {
     *m_d = *other.m_d;
+    m_d->cloneInternFunctions();
+  }
 }
 Interpreter::Interpreter(Interpreter&& other) {
   std::swap(m_d, other.m_d);
 }
 Interpreter& Interpreter::operator=(const Interpreter& other) {
-  if ((this != &other) && m_d && other.m_d)
+  if ((this != &other) && m_d && other.m_d) {
     *m_d = *other.m_d;
+    m_d->cloneInternFunctions();
+  }
   return *this;
 }
 Interpreter& Interpreter::operator=(Interpreter&& other) {
@@ -1235,50 +3360,81 @@ bool Interpreter::parseScript(std::string script, string& outErr) {
 std::string Interpreter::runScript() {
   return m_d ? m_d->runScript() : "";
 }
-bool Interpreter::addFunction(const string& name, UserFunction ufunc) {
-  return m_d ? m_d->addFunction(name, ufunc) : false;
+bool Interpreter::evalScript(const std::string& script, std::string& outResult, std::string& outErr) {
+  return m_d ? Impl::current(m_d)->evalScript(script, outResult, outErr) : false;
+}
+bool Interpreter::addFunction(const string& name, UserFunction ufunc, bool pure) {
+  return m_d ? m_d->addFunction(name, ufunc, pure) : false;
 }
-bool Interpreter::addOperator(const string& name, UserOperator uoper, uint32_t priority) {
-  return m_d ? m_d->addOperator(name, uoper, priority) : false;
+bool Interpreter::addFunctionView(const string& name, UserFunctionView ufunc, bool pure) {
+  return m_d ? m_d->addFunctionView(name, ufunc, pure) : false;
+}
+bool Interpreter::addOperator(const string& name, UserOperator uoper, uint32_t priority, bool pure, OperandMutability mutability) {
+  return m_d ? m_d->addOperator(name, uoper, priority, pure, mutability) : false;
+}
+bool Interpreter::addOperatorView(const string& name, UserOperatorView uoper, uint32_t priority, bool pure) {
+  return m_d ? m_d->addOperatorView(name, uoper, priority, pure) : false;
+}
+bool Interpreter::addOperatorInt64(const string& name, UserOperatorInt64 uoper) {
+  return m_d ? m_d->addOperatorInt64(name, uoper) : false;
+}
+bool Interpreter::addOperatorDouble(const string& name, UserOperatorDouble uoper) {
+  return m_d ? m_d->addOperatorDouble(name, uoper) : false;
+}
+bool Interpreter::addIterable(UserIterable uiter) {
+  return m_d ? m_d->addIterable(uiter) : false;
+}
+bool Interpreter::addType(const std::string& name, ValueType type) {
+  return m_d ? m_d->addType(name, type) : false;
 }
 bool Interpreter::addAttribute(const std::string& name) {
   return m_d ? m_d->addAttribute(name) : false;
 }
 std::map<std::string, std::string> Interpreter::allVariables() const {
-  return m_d ? m_d->allVariables() : std::map<std::string, std::string>();
+  return m_d ? Impl::current(m_d)->allVariables() : std::map<std::string, std::string>();
 }
 std::string Interpreter::variable(const std::string& vname) const {
-  return m_d ? m_d->variable(vname) : "";
+  return m_d ? Impl::current(m_d)->variable(vname) : "";
+}
+std::string Interpreter::variableType(const std::string& vname) const {
+  return m_d ? Impl::current(m_d)->variableType(vname) : "";
 }
 std::string Interpreter::runFunction(const std::string& fname, const std::vector<std::string>& args) {
   return m_d ? m_d->runFunction(fname, args) : "";
 }
 bool Interpreter::setVariable(const std::string& vname, const std::string& value) {
-  return m_d ? m_d->setVariable(vname, value) : false;
+  return m_d ? Impl::current(m_d)->setVariable(vname, value) : false;
 }
 bool Interpreter::setMacro(const std::string& mname, const std::string& script) {
   return m_d ? m_d->setMacro(mname, script) : false;
 }
 bool Interpreter::gotoOnLabel(const std::string& lname) {
-  return m_d ? m_d->gotoOnLabel(lname) : false;
+  return m_d ? Impl::current(m_d)->gotoOnLabel(lname) : false;
 }
 void Interpreter::exitFromScript() {
-  if (m_d) m_d->exitFromScript();
+  if (m_d) Impl::current(m_d)->exitFromScript();
 }
 std::vector<Interpreter::Entity> Interpreter::allEntities() {
-  return m_d ? m_d->allEntities() : std::vector<Interpreter::Entity>();
+  return m_d ? Impl::current(m_d)->allEntities() : std::vector<Interpreter::Entity>();
 }
 Interpreter::Entity Interpreter::currentEntity() {
-  return m_d ? m_d->currentEntity() : Interpreter::Entity{ 0 };
+  return m_d ? Impl::current(m_d)->currentEntity() : Interpreter::Entity{ 0 };
 }
 Interpreter::Entity Interpreter::getEntityByIndex(size_t beginIndex) {
-  return m_d ? m_d->getEntityByIndex(beginIndex) : Interpreter::Entity{ 0 };
+  return m_d ? Impl::current(m_d)->getEntityByIndex(beginIndex) : Interpreter::Entity{ 0 };
+}
+size_t Interpreter::currentIndex() {
+  return m_d ? Impl::current(m_d)->currentIndex() : 0;
+}
+const std::string& Interpreter::getNameByIndex(size_t beginIndex) {
+  static const std::string empty;
+  return m_d ? Impl::current(m_d)->getNameByIndex(beginIndex) : empty;
 }
 std::vector<std::string> Interpreter::getAttributeByIndex(size_t beginIndex) {
-  return m_d ? m_d->getAttributeByIndex(beginIndex) : std::vector<std::string>();
+  return m_d ? Impl::current(m_d)->getAttributeByIndex(beginIndex) : std::vector<std::string>();
 }
 bool Interpreter::gotoOnEntity(size_t beginIndex) {
-  return m_d ? m_d->gotoOnEntity(beginIndex) : false;
+  return m_d ? Impl::current(m_d)->gotoOnEntity(beginIndex) : false;
 }
 Interpreter::UserFunction Interpreter::getUserFunction(const std::string& fname) {
   return m_d ? m_d->getUserFunction(fname) : nullptr;
@@ -1286,3 +3442,89 @@ Interpreter::UserFunction Interpreter::getUserFunction(const std::string& fname)
 Interpreter::UserOperator Interpreter::getUserOperator(const std::string& oname) {
   return m_d ? m_d->getUserOperator(oname) : nullptr;
 }
+void Interpreter::useBytecode(bool on) {
+  if (m_d) m_d->useBytecode(on);
+}
+void Interpreter::setScriptCacheCapacity(size_t capacity) {
+  if (m_d) m_d->setScriptCacheCapacity(capacity);
+}
+void Interpreter::setMaxCallDepth(size_t depth) {
+  if (m_d) m_d->setMaxCallDepth(depth);
+}
+void Interpreter::useProfiler(bool on) {
+  if (m_d) m_d->useProfiler(on);
+}
+std::vector<Interpreter::EntityProfile> Interpreter::profile() {
+  return m_d ? m_d->profile() : std::vector<Interpreter::EntityProfile>();
+}
+std::string Interpreter::profileFolded() const {
+  return m_d ? m_d->profileFolded() : std::string();
+}
+void Interpreter::useOptimization(bool on) {
+  if (m_d) m_d->useOptimization(on);
+}
+std::vector<std::string> Interpreter::runBatch(const std::string& script, const std::vector<std::map<std::string, std::string>>& inputs, size_t threads, BatchStat* outStat) {
+  return m_d ? m_d->runBatch(script, inputs, threads, outStat) : std::vector<std::string>(inputs.size());
+}
+void Interpreter::setRunLimits(size_t maxSteps, size_t timeoutMs) {
+  if (m_d) m_d->setRunLimits(maxSteps, timeoutMs);
+}
+void Interpreter::cancel() {
+  if (m_d) m_d->cancel();
+}
+Interpreter::RunStatus Interpreter::runStatus() const {
+  return m_d ? m_d->runStatus() : RunStatus::OK;
+}
+std::shared_ptr<const Interpreter::CompiledScript> Interpreter::compileScript(std::string script, std::string& outErr) {
+  if (!m_d) return nullptr;
+  auto program = m_d->sharedProgram(move(script), outErr);
+  if (!program) return nullptr;
+  auto compiled = make_shared<CompiledScript>();
+  compiled->program = move(program);
+  return compiled;
+}
+
+Interpreter::ExecutionContext::ExecutionContext(std::shared_ptr<const CompiledScript> script) {
+  if (script && script->program)
+    m_d = new Interpreter::Impl(script->program);
+}
+Interpreter::ExecutionContext::~ExecutionContext() {
+  if (m_d) delete m_d;
+}
+Interpreter::ExecutionContext::ExecutionContext(ExecutionContext&& other) {
+  std::swap(m_d, other.m_d);
+}
+Interpreter::ExecutionContext& Interpreter::ExecutionContext::operator=(ExecutionContext&& other) {
+  if (this != &other) {
+    std::swap(m_d, other.m_d);
+  }
+  return *this;
+}
+std::string Interpreter::ExecutionContext::run() {
+  return m_d ? m_d->runScript() : "";
+}
+void Interpreter::ExecutionContext::setRunLimits(size_t maxSteps, size_t timeoutMs) {
+  if (m_d) m_d->setRunLimits(maxSteps, timeoutMs);
+}
+void Interpreter::ExecutionContext::cancel() {
+  if (m_d) m_d->cancel();
+}
+Interpreter::RunStatus Interpreter::ExecutionContext::runStatus() const {
+  return m_d ? m_d->runStatus() : RunStatus::OK;
+}
+bool Interpreter::ExecutionContext::setVariable(const std::string& vname, const std::string& value) {
+  return m_d ? m_d->setVariable(vname, value) : false;
+}
+std::string Interpreter::ExecutionContext::variable(const std::string& vname) const {
+  return m_d ? m_d->variable(vname) : "";
+}
+std::map<std::string, std::string> Interpreter::ExecutionContext::allVariables() const {
+  return m_d ? m_d->allVariables() : std::map<std::string, std::string>();
+}
+void Interpreter::scriptCacheStat(size_t& outHits, size_t& outMisses) const {
+  outHits = outMisses = 0;
+  if (m_d) m_d->scriptCacheStat(outHits, outMisses);
+}
+size_t Interpreter::macroExpandedSize() const {
+  return m_d ? m_d->macroExpandedSize() : 0;
+}
@@ -2,28 +2,48 @@
 #include "../include/interpreter_c.h"
 #include "../include/interpreter.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
 
+struct IntrC {
+    Interpreter ir;
+    std::string result, value;  // are kept until the next call
+};
+
+static size_t copyToBuff(const std::string& str, char* outBuff, size_t buffSize){
+    if (outBuff && (buffSize > 0)){
+        size_t sz = std::min(str.size(), buffSize - 1);
+        memcpy(outBuff, str.data(), sz);
+        outBuff[sz] = '\0';
+    }
+    return str.size();
+}
+
+static std::string toString(const irStr& str){
+    return str.data ? std::string(str.data, str.size) : std::string();
+}
+
 HIntr irCreateIntr(){
-    return new Interpreter();
+    return new IntrC();
+}
+
+void irDeleteIntr(HIntr h){
+    delete reinterpret_cast<IntrC*>(h);
 }
 
 BOOL irAddFunction(HIntr h, char* name, irUserFunction ufunc){
     if (!h || !name || !ufunc) return FALSE;
 
-    auto ir = reinterpret_cast<Interpreter*>(h); 
+    auto ir = &reinterpret_cast<IntrC*>(h)->ir; 
 
     ir->addFunction(name, [ufunc](const std::vector<std::string>& args)->std::string{
         
-        char** cargs = new char*[args.size()];
+        std::vector<char*> cargs(args.size());
         for(size_t i = 0; i < args.size(); ++i){
         cargs[i] = (char*)args[i].c_str();
         }
-        auto res = ufunc(cargs, args.size());
-
-        free(cargs);
-
-        return res;
+        return ufunc(cargs.data(), args.size());
     });
     return TRUE;
 }
@@ -31,15 +51,15 @@ BOOL irAddFunction(HIntr h, char* name, irUserFunction ufunc){
 BOOL irAddOperator(HIntr h, char* name, irUserOperator uopr, uint32_t priority){
     if (!h || !name || !uopr) return FALSE;
 
-    auto ir = reinterpret_cast<Interpreter*>(h); 
+    auto ir = &reinterpret_cast<IntrC*>(h)->ir; 
 
     ir->addOperator(name, [uopr](std::string& left, std::string& right)->std::string{
       
-      char* cleft = new char[left.size() + 1]{};
-      strcpy(cleft, left.c_str());
+      char* cleft = (char*)malloc(left.size() + 1);
+      memcpy(cleft, left.c_str(), left.size() + 1);
 
-      char* cright = new char[right.size() + 1]{};
-      strcpy(cright, right.c_str());
+      char* cright = (char*)malloc(right.size() + 1);
+      memcpy(cright, right.c_str(), right.size() + 1);
 
       auto res = uopr(&cleft, &cright);
 
@@ -54,11 +74,66 @@ BOOL irAddOperator(HIntr h, char* name, irUserOperator uopr, uint32_t priority){
 
     return TRUE;
 }
+
+BOOL irAddFunctionView(HIntr h, const char* name, irUserFunctionView ufunc, void* userData){
+    if (!h || !name || !ufunc) return FALSE;
+
+    auto ir = &reinterpret_cast<IntrC*>(h)->ir;
+
+    return ir->addFunctionView(name, [ufunc, userData](Interpreter::ArgsView args, std::string& outResult){
+
+        const size_t LOCAL_COUNT = 8;  // arguments without allocation
+        irStr local[LOCAL_COUNT];
+        std::vector<irStr> heap;
+        irStr* cargs = local;
+        if (args.size() > LOCAL_COUNT){
+            heap.resize(args.size());
+            cargs = heap.data();
+        }
+        for(size_t i = 0; i < args.size(); ++i){
+            cargs[i] = irStr{ args[i].data(), args[i].size() };
+        }
+        irStr res = ufunc(cargs, args.size(), userData);
+        if (res.data){
+            outResult.assign(res.data, res.size);
+        }
+    }) ? TRUE : FALSE;
+}
+
+BOOL irAddOperatorView(HIntr h, const char* name, irUserOperatorView uopr, uint32_t priority, void* userData){
+    if (!h || !name || !uopr) return FALSE;
+
+    auto ir = &reinterpret_cast<IntrC*>(h)->ir;
+
+    return ir->addOperator(name, [uopr, userData](std::string& left, std::string& right)->std::string{
+
+        irStr cleft{ left.data(), left.size() },
+              cright{ right.data(), right.size() };
+
+        // the result and new operands can point to the operands
+        std::string res = toString(uopr(&cleft, &cright, userData));
+
+        bool isLeftChanged = (cleft.data != left.data()) || (cleft.size != left.size()),
+             isRightChanged = (cright.data != right.data()) || (cright.size != right.size());
+        if (isLeftChanged && isRightChanged){
+            std::string newLeft = toString(cleft);
+            right = toString(cright);
+            left.swap(newLeft);
+        }
+        else if (isLeftChanged){
+            left = toString(cleft);
+        }
+        else if (isRightChanged){
+            right = toString(cright);
+        }
+        return res;
+    }, priority) ? TRUE : FALSE;
+}
    
 char* irCmd(HIntr h, char* script){
     if (!h || !script) return NULL;
 
-    auto ir = reinterpret_cast<Interpreter*>(h); 
+    auto ir = &reinterpret_cast<IntrC*>(h)->ir; 
 
     auto res = ir->cmd(script);
 
@@ -71,7 +146,7 @@ char* irCmd(HIntr h, char* script){
 BOOL irParseScript(HIntr h, char* script, char* outErr /*sz 256*/){
     if (!h || !script) return FALSE;
 
-    auto ir = reinterpret_cast<Interpreter*>(h); 
+    auto ir = &reinterpret_cast<IntrC*>(h)->ir; 
 
     std::string err;
     bool res = ir->parseScript(script, err);
@@ -85,7 +160,7 @@ BOOL irParseScript(HIntr h, char* script, char* outErr /*sz 256*/){
 char* irRunScript(HIntr h){
     if (!h) return NULL;
 
-    auto ir = reinterpret_cast<Interpreter*>(h); 
+    auto ir = &reinterpret_cast<IntrC*>(h)->ir; 
 
     auto res = ir->runScript();
 
@@ -98,7 +173,7 @@ char* irRunScript(HIntr h){
 char* irVariable(HIntr h, char* vname){
     if (!h || !vname) return NULL;
 
-    auto ir = reinterpret_cast<Interpreter*>(h); 
+    auto ir = &reinterpret_cast<IntrC*>(h)->ir; 
 
     auto res = ir->variable(vname);
 
@@ -108,10 +183,79 @@ char* irVariable(HIntr h, char* vname){
     return cres;
 }
 
+const char* irCmdRef(HIntr h, const char* script, size_t* outSize){
+    if (!h || !script) return NULL;
+
+    auto c = reinterpret_cast<IntrC*>(h);
+
+    c->result = c->ir.cmd(script);
+
+    if (outSize) *outSize = c->result.size();
+    return c->result.c_str();
+}
+
+const char* irRunScriptRef(HIntr h, size_t* outSize){
+    if (!h) return NULL;
+
+    auto c = reinterpret_cast<IntrC*>(h);
+
+    c->result = c->ir.runScript();
+
+    if (outSize) *outSize = c->result.size();
+    return c->result.c_str();
+}
+
+const char* irVariableRef(HIntr h, const char* vname, size_t* outSize){
+    if (!h || !vname) return NULL;
+
+    auto c = reinterpret_cast<IntrC*>(h);
+
+    c->value = c->ir.variable(vname);
+
+    if (outSize) *outSize = c->value.size();
+    return c->value.c_str();
+}
+
+size_t irCmdBuff(HIntr h, const char* script, char* outBuff, size_t buffSize){
+    if (!h || !script) return 0;
+
+    auto c = reinterpret_cast<IntrC*>(h);
+
+    c->result = c->ir.cmd(script);
+
+    return copyToBuff(c->result, outBuff, buffSize);
+}
+
+size_t irRunScriptBuff(HIntr h, char* outBuff, size_t buffSize){
+    if (!h) return 0;
+
+    auto c = reinterpret_cast<IntrC*>(h);
+
+    c->result = c->ir.runScript();
+
+    return copyToBuff(c->result, outBuff, buffSize);
+}
+
+size_t irVariableBuff(HIntr h, const char* vname, char* outBuff, size_t buffSize){
+    if (!h || !vname) return 0;
+
+    auto c = reinterpret_cast<IntrC*>(h);
+
+    c->value = c->ir.variable(vname);
+
+    return copyToBuff(c->value, outBuff, buffSize);
+}
+
+size_t irLastResult(HIntr h, char* outBuff, size_t buffSize){
+    if (!h) return 0;
+
+    return copyToBuff(reinterpret_cast<IntrC*>(h)->result, outBuff, buffSize);
+}
+
 BOOL irSetVariable(HIntr h, char* vname, char* value){
     if (!h || !vname || !value) return FALSE;
 
-    auto ir = reinterpret_cast<Interpreter*>(h); 
+    auto ir = &reinterpret_cast<IntrC*>(h)->ir; 
 
     auto res = ir->setVariable(vname, value);
 
@@ -121,7 +265,7 @@ BOOL irSetVariable(HIntr h, char* vname, char* value){
 BOOL irSetMacro(HIntr h, char* mname, char* script){
     if (!h || !mname || !script) return FALSE;
 
-    auto ir = reinterpret_cast<Interpreter*>(h); 
+    auto ir = &reinterpret_cast<IntrC*>(h)->ir; 
 
     auto res = ir->setMacro(mname, script);
 
@@ -131,7 +275,7 @@ BOOL irSetMacro(HIntr h, char* mname, char* script){
 BOOL irGotoOnLabel(HIntr h, char* lname){
     if (!h || !lname) return FALSE;
 
-    auto ir = reinterpret_cast<Interpreter*>(h); 
+    auto ir = &reinterpret_cast<IntrC*>(h)->ir; 
 
     auto res = ir->gotoOnLabel(lname);
 
@@ -141,7 +285,7 @@ BOOL irGotoOnLabel(HIntr h, char* lname){
 void irExitFromScript(HIntr h){
     if (!h) return;
 
-    auto ir = reinterpret_cast<Interpreter*>(h); 
+    auto ir = &reinterpret_cast<IntrC*>(h)->ir; 
 
     ir->exitFromScript();
 }
\ No newline at end of file
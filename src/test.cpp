@@ -24,13 +24,16 @@
 //
 #include <gtest/gtest.h>
 #include "../include/interpreter.h"
+#include "../include/interpreter_c.h"
 #include "../include/base_library/arithmetic_operations.h"
 #include "../include/base_library/comparison_operations.h"
 #include "../include/base_library/containers.h"
+#include "../include/base_library/filesystem.h"
 #include "../include/base_library/structure.h"
 #include "../include/base_library/types.h"
 
 #include <ostream>
+#include <thread>
 
 using namespace std;
 
@@ -146,6 +149,13 @@ TEST_F(InprTest, macrosTest){
   EXPECT_TRUE(ir.cmd("$a = 5; #macro myMacr{$a = $a + 2;} #myMacr; #myMacr; #myMacr;") == "11");
   EXPECT_TRUE(ir.cmd("$a = 5; #macro myMacr{ $a = $a + $0 + $0 + $1; } #myMacr(3,4);") == "15");
   EXPECT_TRUE(ir.cmd("#macro RANGE{while(range($0))}; $a = 0; #RANGE(100) $a += 1; $a;") == "100");
+  EXPECT_TRUE(ir.cmd("#macro INC{$a += $0;} #macro INC2{#INC($0) #INC($1)} $a = 0; #INC2(1, 2); #INC2(1, 2); $a") == "6");
+  EXPECT_TRUE(ir.cmd("#macro AB{$a = $10 + $1;} $a = 0; #AB(1, 2) $s = \"#AB\"; $a") == "2");
+  EXPECT_TRUE(ir.macroExpandedSize() == string("$a=0;$a=$10+2;$s=\"#AB\";$a;").size());
+  EXPECT_TRUE(ir.cmd("#macro LOOP{#LOOP} #LOOP").find("Error") == 0);
+  EXPECT_TRUE(ir.cmd("$a = 0; #UNKNOWN").find("Error") == 0);
+  ir.setMacro("#SET", "$b = $0 + 1; // comment");
+  EXPECT_TRUE(ir.cmd("#SET(2) $b") == "3");
 }
 TEST_F(InprTest, gotoTest){   
   EXPECT_TRUE(ir.cmd("$a = 5; $b = 2; goto l_jmp; $a = summ($a, $b); l_jmp: $a;") == "5");
@@ -161,11 +171,23 @@ TEST_F(InprTest, containerTest){
   EXPECT_TRUE(ir.cmd("a = Vector; a.push_back(1); a.push_back(2); a.push_back(3); a[1 + 1]") == "3");
   EXPECT_TRUE(ir.cmd("b = Map; b.insert(myKeyOne, myValueOne); b.insert(myKeyTwo, myValueTwo); b.at(myKeyTwo)") == "myValueTwo");
   EXPECT_TRUE(ir.cmd("b = Map; b.insert(myKeyOne, myValueOne); b.insert(myKeyTwo, myValueTwo); b[\"myKeyTwo\"]") == "myValueTwo");
+  for (bool bytecode : {true, false}) {
+    ir.useBytecode(bytecode);
+    EXPECT_TRUE(ir.cmd("a = Vector{5, 6, 7}; b = Vector{2, 0, 1}; a[b[0]] + a[b[2]]") == "13");
+    EXPECT_TRUE(ir.cmd("a = Vector{1, 2, 3, 4}; $s = 0; $i = 0; while ($i < 2) { $s += a[$i * 2 + 1]; $i += 1; }; $s") == "6");
+    EXPECT_TRUE(ir.cmd("b = Map{one : 1, two : 2}; $k = \"two\"; b[$k] + b.at(one)") == "3");
+    EXPECT_TRUE(ir.cmd("a = Vector{1, 2}; a[5]").empty());
+  }
+  ir.useBytecode(true);
 }
 TEST_F(InprTest, structureTest){ 
   EXPECT_TRUE(ir.cmd("e = Struct{ one : 5, two : 2}; e.one = summ(e.one, e.two); e.one") == "7");
   EXPECT_TRUE(ir.cmd("$b = 12; e = Struct{ one : $b + 5, two : 2}; e.three = $b; e.three") == "12");
   EXPECT_TRUE(ir.cmd("$b = 12; e = Struct{ one : $b + 5, two : 2}; e.three = e.one + e.two + 3; e.three") == "22");
+  EXPECT_TRUE(ir.cmd("e = Struct{ one : 1, two : 2}; f = Struct{ two : 3, one : 4}; $i = 0; $s = 0; "
+                     "while ($i < 4) { if ($i == 2) e = Struct{ two : 10 }; $s = $s + e.two + f.one; $i += 1; }; $s") == "40");
+  EXPECT_TRUE(ir.cmd("e = Struct{ a : 1}; f = Struct{ a : 2}; $i = 0; while ($i < 3) { e.b = $i; f.c = e.b + f.a; $i += 1; }; f.c + e.b") == "6");
+  EXPECT_TRUE(ir.cmd("e = Struct{ one : 1}; e = Struct{ two : 2}; e.one") == "");
 }
 TEST_F(InprTest, internFuncTest){ 
   EXPECT_TRUE(ir.cmd("$a = 1; $b = 2; function myFunc{ $a += $b; }; myFunc()") == "3");
@@ -173,13 +195,497 @@ TEST_F(InprTest, internFuncTest){
   EXPECT_TRUE(ir.cmd("function myFunc{ if ($0 > 1) $a = $0 * myFunc($0 - 1); else $a = 1; $a }; myFunc(5)") == "120");
   EXPECT_TRUE(ir.cmd("function myFunc{ $0 += $1; }; myFunc(2, 3)") == "5");
 }
+TEST_F(InprTest, callFrameTest){
+  EXPECT_TRUE(ir.cmd("function fib{ if ($0 < 2) $r = $0; else $r = fib($0 - 1) + fib($0 - 2); $r }; fib(15)") == "610");
+  EXPECT_TRUE(ir.cmd("function fsum{ $0 + $1 }; function fcall{ fsum($0, 1) + $0 }; fcall(5)") == "11");
+  EXPECT_TRUE(ir.cmd("function fback{ if ($0 > 0) fback($0 - 1); $0 }; fback(3)") == "3");
+  EXPECT_TRUE(ir.cmd("function fsq{ $0 * $0 }; function fouter{ function finner{ fsq($0) + 1 }; finner($0) + fsq($1) }; fouter(2, 3)") == "14");
+  EXPECT_TRUE(ir.cmd("$x = 1; function fincx{ $x += 1 }; function fcallx{ fincx(); $x * 10 }; $y = fcallx(); fincx(); $x + $y") == "23");
+  ir.addFunction("twice", [](const vector<string>& args) { return args.empty() ? string() : to_string(2 * stoi(args[0])); });
+  EXPECT_TRUE(ir.cmd("function ftwice{ twice($0) }; ftwice(4)") == "8");
+  ir.setMaxCallDepth(10);
+  EXPECT_TRUE(ir.cmd("$n = 0; function down{ $n += 1; if ($0 > 0) down($0 - 1); $n }; down(50)") == "10");
+}
 TEST_F(InprTest, typesTest){ 
   EXPECT_TRUE(ir.cmd("$a: int = 123; type($a)") == "int");
   EXPECT_TRUE(ir.cmd("$b: str = \"abc\"; type($b)") == "str");
+  EXPECT_TRUE(ir.cmd("$a: int = 123; $a") == "123");
+  EXPECT_TRUE(ir.cmd("$a: int = 123; $s = \"x\"; type($a + $s)") == "");
+  EXPECT_TRUE(ir.cmd("$a: int = 123; type($a, $a)") == "");
+  EXPECT_TRUE(ir.cmd("$a: int = 0; $s: int = 0; while($a < 10){ $s += $a; $a += 1; } $s") == "45");
+  EXPECT_TRUE(ir.cmd("$a: int = 5; $a = $a + \"x\"; $a") == "5x");
+  string err;
+  EXPECT_TRUE(!ir.parseScript("$a: int = abc", err) && (err == "Error type: $a is int, assigned abc"));
+  EXPECT_TRUE(!ir.parseScript("$a: int = 1; $s: str = x; $a = $s", err) && (err == "Error type: $a is int, assigned $s"));
+  EXPECT_TRUE(!ir.parseScript("$a: int = 1; $a: str = x", err) && (err == "Error type: $a is int, declared str"));
 }
-TEST_F(InprTest, attributesTest){ 
+TEST_F(InprTest, attributesTest){
   EXPECT_TRUE(ir.cmd("[attr1,attr2,attr3] getAttr()") == "attr1,attr2,attr3");
 }
+TEST_F(InprTest, valueTest){
+  EXPECT_TRUE(ir.cmd("$a = 007; $a") == "007");
+  EXPECT_TRUE(ir.cmd("$a = 2 - 5; $a") == "-3");
+  EXPECT_TRUE(ir.cmd("$a = 12; $b = $a + 30; $b") == "42");
+  EXPECT_TRUE(ir.cmd("$a = 12; $b = $a + \"x\"; $b") == "12x");
+  EXPECT_TRUE(ir.setVariable("$c", "0015") && (ir.variable("$c") == "0015"));
+}
+TEST_F(InprTest, variableTest){
+  EXPECT_TRUE(ir.setVariable("$newVar", "5"));
+  EXPECT_TRUE(ir.cmd("$other = $newVar + 2; $other") == "7");
+  EXPECT_TRUE(ir.variable("$other") == "7");
+  EXPECT_TRUE(ir.allVariables().count("$newVar") && ir.allVariables().count("$other"));
+  EXPECT_TRUE(ir.variable("$missing") == "");
+}
+TEST_F(InprTest, typedOperatorTest){
+  EXPECT_FALSE(ir.addOperatorInt64("%", [](int64_t&, int64_t&, int64_t&) ->bool { return true; }));
+  ir.addOperator("%", [](string& leftOpd, string& rightOpd) ->string {
+    return "str";
+  }, 0);
+  EXPECT_TRUE(ir.addOperatorInt64("%", [](int64_t& leftOpd, int64_t& rightOpd, int64_t& result) ->bool {
+    if (rightOpd == 0) return false;
+    result = leftOpd % rightOpd;
+    return true;
+  }));
+  EXPECT_TRUE(ir.cmd("$a = 17 % 5; $a") == "2");
+  EXPECT_TRUE(ir.cmd("$a = 17 % 0; $a") == "str");
+  EXPECT_TRUE(ir.cmd("$a = 17 % \"abc\"; $a") == "str");
+  EXPECT_TRUE(ir.cmd("$a = 2 - 5; $b = $a + 1; $b") == "-31");
+  EXPECT_TRUE(ir.cmd("$a = 10; $a += 5; $a -= 3; $b = $a * 2 + 3; $b") == "27");
+
+  // the parsed script gets the new fast path
+  ir.addOperatorInt64("+", [](int64_t& leftOpd, int64_t& rightOpd, int64_t& result) ->bool {
+    result = leftOpd + rightOpd;
+    return true;
+  });
+  EXPECT_TRUE(ir.cmd("1 + 2") == "3");
+  ir.addOperatorInt64("+", [](int64_t&, int64_t&, int64_t& result) ->bool {
+    result = 100;
+    return true;
+  });
+  EXPECT_TRUE(ir.cmd("1 + 2") == "100");
+}
+TEST_F(InprTest, scriptCacheTest){
+  ir.setScriptCacheCapacity(2);
+  const string a = "$a = 1; $a += 2; $a",
+               b = "$b{5}; $b += 1; $b",
+               c = "$c = 3; $c";
+  EXPECT_TRUE(ir.cmd(a) == "3");
+  EXPECT_TRUE(ir.cmd(b) == "6");
+  EXPECT_TRUE(ir.cmd(a) == "3");
+  EXPECT_TRUE(ir.cmd(b) == "6");
+  size_t hits = 0, misses = 0;
+  ir.scriptCacheStat(hits, misses);
+  EXPECT_TRUE((hits == 2) && (misses == 2));
+
+  EXPECT_TRUE(ir.cmd(c) == "3");
+  EXPECT_TRUE(ir.cmd(a) == "3");
+  ir.scriptCacheStat(hits, misses);
+  EXPECT_TRUE((hits == 2) && (misses == 4));
+
+  ir.setMacro("#mc", "$m=1;");
+  EXPECT_TRUE(ir.cmd("#mc; $m") == "1");
+  EXPECT_TRUE(ir.cmd(a) == "3");
+  ir.setMacro("#mc", "$m=2;");
+  EXPECT_TRUE(ir.cmd("#mc; $m") == "2");
+
+  // the change of macro drops only the scripts with it
+  ir.scriptCacheStat(hits, misses);
+  ir.setMacro("#mc", "$m=3;");
+  EXPECT_TRUE(ir.cmd(a) == "3");
+  EXPECT_TRUE(ir.cmd("#mc; $m") == "3");
+  size_t hitsAfter = 0, missesAfter = 0;
+  ir.scriptCacheStat(hitsAfter, missesAfter);
+  EXPECT_TRUE((hitsAfter == hits + 1) && (missesAfter == misses + 1));
+
+  ir.setMacro("#in", "($m + 1)");
+  ir.setMacro("#out", "$r = #in * 2;");
+  EXPECT_TRUE(ir.cmd("#out; $r") == "8");
+  ir.setMacro("#in", "($m + 2)");  // the expansion of #out is dropped too
+  EXPECT_TRUE(ir.cmd("#out; $r") == "10");
+}
+TEST_F(InprTest, nameLookupTest){
+  ir.addFunction("sum", [](const vector<string>& args) ->string {
+    return "sum";
+  });
+  EXPECT_TRUE(ir.cmd("summ(1, 2)") == "3");
+  EXPECT_TRUE(ir.cmd("sum(1, 2)") == "sum");
+  EXPECT_TRUE(ir.cmd("$a = 5; $a -> $b; $b") == "5");
+  EXPECT_TRUE(ir.cmd("$a = 5; $a -= 2; $a") == "3");
+}
+TEST_F(InprTest, lexerTest){
+  EXPECT_TRUE(ir.cmd("$a = 1; // comment \"\n  $b = \"a b\"; // second comment\n$b") == "a b");
+  EXPECT_TRUE(ir.cmd("$a = \"http://a b\"; $a") == "http://a b");
+  EXPECT_TRUE(ir.cmd("$a = 1;\r\n\t$a += 2;\r\n$a") == "3");
+  EXPECT_TRUE(ir.cmd("$a = 1;\n  while (0) {}").find("Error script pos 15") == 0);
+  // nested parts are parsed on the matched brackets of the whole script
+  EXPECT_TRUE(ir.cmd("summ(summ(1, 2), summ(3, summ(4, (5))), 6)") == "21");
+  EXPECT_TRUE(ir.cmd("$a = 0; if ($a < 1) { if (($a + 1) < 2) $a = summ(2, (3)); } $a") == "5");
+  EXPECT_TRUE(ir.cmd("$a = 1; if ($a > 0) { $b = summ(1, 2)) }").find("Error") == 0);
+}
+TEST_F(InprTest, bytecodeTest){
+  vector<string> scripts = {
+    "$a = 5; $b = 2; $c = summ($a, ($a + ($a * ($b + $a))), summ(5)); $c;",
+    "$a = 3; if ($a == 1) { $b = 1; } elseif ($a == 2) { $b = 2; } else { $b = 3; } $b",
+    "$a = 0; $c = 0; while ($a < 3) { $a += 1; $b = 0; while ($b < 3) { $b += 1; if ($b == 2) { continue; } $c += 1; } } $c",
+    "$a = 3; while ($a > 0) { $a -= 1; if ($a == 1) { break; } }",
+    "$a = 1; if ($a == 1) { break; } $a",
+    "$a = 0; goto l_in; while ($a < 3) { $a += 1; if (1) { l_in: $a += 10; } $a += 100; } $a",
+    "$a = 0; while ($a < 300) { $a += 1; goto l_in; if (0) { $a += 5; l_in: $a += 10; } $a += 100; } $a",
+    "function myFunc{ if ($0 > 1) $a = $0 * myFunc($0 - 1); else $a = 1; $a }; myFunc(5)",
+    "$a = 0; while(range(10)) $a += 1; $a;",
+    "$a = 2; $b = 1; $c = $a + 3 * $b * ($a + 1) + $a * $a * 2 + ($b += 2) * $b + 7; $c",
+  };
+  for (const auto& s : scripts){
+    ir.useBytecode(false);
+    string walkRes = ir.cmd(s);
+    auto walkVars = ir.allVariables();
+    ir.useBytecode(true);
+    EXPECT_TRUE(ir.cmd(s) == walkRes);
+    EXPECT_TRUE(ir.allVariables() == walkVars);
+  }
+}
+TEST_F(InprTest, optimizationTest){
+  ir.useOptimization(true);
+  EXPECT_TRUE(ir.cmd("$a = (1 + 2) * 3; $a") == "9");
+  EXPECT_TRUE(ir.allEntities().size() == 6);  // $a = 9; $a
+  EXPECT_TRUE(ir.cmd("$a = 2; if (1 > 2) $a = 5; else $a = 7; $a") == "7");
+  for (const auto& e : ir.allEntities()){
+    EXPECT_TRUE((e.type != Interpreter::EntityType::IF) && (e.type != Interpreter::EntityType::ELSE));
+  }
+  EXPECT_TRUE(ir.cmd("$a = 1; goto l_x; if (0) { l_x: $a = 3; } $a") == "3");
+  EXPECT_TRUE(ir.cmd("$b = 0; while ($b < 3) { $b += 1; if (1) { break; } } $b") == "1");
+  vector<string> scripts = {
+    "$a = 5; $b = 2; $c = summ($a, ($a + ($a * (2 + 3))), summ(5)); $c;",
+    "$a = 3; if (1 == 2) { $b = 1; } elseif ($a == 2) { $b = 2; } else { $b = 3 + 4; } $b",
+    "$a = 1; if (0) { $a = 5; } elseif (2 > 1) { if (1) { $a = 4 + 5 * 2; } } else { $a = 7; } $a",
+  };
+  for (const auto& s : scripts){
+    ir.useOptimization(false);
+    string res = ir.cmd(s);
+    ir.useOptimization(true);
+    EXPECT_TRUE(ir.cmd(s) == res);
+  }
+}
+TEST_F(InprTest, executionContextTest){
+  string err;
+  auto script = ir.compileScript("$s = 0; $c = 0; while ($c < $n) { $c += 1; $s = summ($s, $c); } $s", err);
+  ASSERT_TRUE(script != nullptr);
+  EXPECT_TRUE(ir.compileScript("while (0) {}", err) == nullptr);
+
+  vector<Interpreter::ExecutionContext> contexts;
+  for (int i = 0; i < 4; ++i){
+    contexts.emplace_back(script);
+    EXPECT_TRUE(contexts.back().setVariable("$n", to_string(10 * (i + 1))));
+  }
+  EXPECT_FALSE(contexts[0].setVariable("$unknown", "1"));
+
+  vector<string> results(contexts.size());
+  vector<thread> threads;
+  for (size_t i = 0; i < contexts.size(); ++i){
+    threads.emplace_back([&contexts, &results, i]{
+      for (int k = 0; k < 100; ++k)
+        results[i] = contexts[i].run();
+    });
+  }
+  for (auto& t : threads) t.join();
+
+  EXPECT_TRUE(results[0] == "55");
+  EXPECT_TRUE(results[3] == "820");
+  EXPECT_TRUE(contexts[1].variable("$c") == "20");
+  EXPECT_TRUE(ir.variable("$c") == "");
+
+  // the base library takes the entities of the running context
+  vector<map<string, string>> inputs = {{{"$a", "5"}}, {{"$a", "7"}}};
+  results = ir.runBatch("v = Vector{1, 2}; v.push_back($a); v.size() * 10 + v[2]", inputs, 1);
+  EXPECT_TRUE((results[0] == "35") && (results[1] == "37"));
+  results = ir.runBatch("e = Struct{one : 1, two : 2}; e.three = e.two + $a; e.three", inputs, 1);
+  EXPECT_TRUE((results[0] == "7") && (results[1] == "9"));
+
+  Interpreter::ExecutionContext ctx(ir.compileScript("m = Map{one : 1}; m.insert(two, $a); m.at(one) + m.at(two)", err));
+  EXPECT_TRUE(ctx.setVariable("$a", "3"));
+  EXPECT_TRUE(ctx.run() == "4");
+}
+TEST_F(InprTest, runBatchTest){
+  vector<map<string, string>> inputs;
+  for (int i = 0; i < 1000; ++i){
+    inputs.push_back({{"$a", to_string(i)}, {"$b", to_string(i % 7)}});
+  }
+  Interpreter::BatchStat stat;
+  auto results = ir.runBatch("$c = 0; while ($b > 0) { $b -= 1; $c += 1; } $a + $c", inputs, 4, &stat);
+  ASSERT_TRUE(results.size() == inputs.size());
+  bool isOrdered = true;
+  for (int i = 0; i < 1000; ++i){
+    isOrdered = isOrdered && (results[i] == to_string(i + i % 7));
+  }
+  EXPECT_TRUE(isOrdered);
+  EXPECT_TRUE(stat.threads == 4);
+  size_t runs = 0;
+  for (auto r : stat.runsByThread) runs += r;
+  EXPECT_TRUE(runs == 1000);
+
+  // the containers of base library are in the library object, one thread
+  results = ir.runBatch("v = Vector{}; while ($b > 0) { v.push_back($a); $b -= 1; } "
+                        "e = Struct{n : 0}; e.n = v.size(); $n = e.n; $n * 1000 + $a", inputs, 1, &stat);
+  ASSERT_TRUE(results.size() == inputs.size());
+  bool isBaseLibOk = true;
+  for (int i = 0; i < 1000; ++i){
+    isBaseLibOk = isBaseLibOk && (results[i] == to_string(i % 7 * 1000 + i));
+  }
+  EXPECT_TRUE(isBaseLibOk);
+  EXPECT_TRUE(stat.threads == 1);
+
+  results = ir.runBatch("while (0) {}", inputs, 4);
+  EXPECT_TRUE(results.size() == inputs.size() && (results[0].find("Error") == 0));
+}
+TEST_F(InprTest, runLimitTest){
+  ir.setRunLimits(1000, 0);
+  EXPECT_TRUE(ir.cmd("$a = 0; while (1) { $a += 1; }") == "Error: step limit");
+  EXPECT_TRUE(ir.runStatus() == Interpreter::RunStatus::STEP_LIMIT);
+  EXPECT_TRUE(ir.cmd("function loop{ while (1) { $b += 1; } }; loop(); $c = 5;") == "Error: step limit");
+  EXPECT_TRUE(ir.variable("$c") == "");
+  ir.useBytecode(false);
+  EXPECT_TRUE(ir.cmd("$a = 0; while (1) { $a += 1; }") == "Error: step limit");
+  ir.useBytecode(true);
+
+  ir.addFunction("evalLoop", [this](const vector<string>& args) ->string {
+    string res, err;
+    ir.evalScript("$e = 0; while (1) { $e += 1; }", res, err);
+    return res;
+  });
+  EXPECT_TRUE(ir.cmd("evalLoop(); $c = 7;") == "Error: step limit");
+  EXPECT_TRUE(ir.variable("$c") == "");
+
+  ir.setRunLimits(0, 20);
+  EXPECT_TRUE(ir.cmd("$a = 0; while (1) { $a += 1; }") == "Error: timeout");
+  EXPECT_TRUE(ir.runStatus() == Interpreter::RunStatus::TIMEOUT);
+
+  ir.setRunLimits(0, 0);
+  EXPECT_TRUE(ir.cmd("$a = 1; $a") == "1");
+  EXPECT_TRUE(ir.runStatus() == Interpreter::RunStatus::OK);
+
+  ir.cancel();  // before the run
+  EXPECT_TRUE(ir.cmd("$a = 1; $a") == "Error: cancelled");
+  EXPECT_TRUE(ir.cmd("$a = 1; $a") == "1");
+
+  string err;
+  Interpreter::ExecutionContext ctx(ir.compileScript("$a = 0; while (1) { $a += 1; }", err));
+  string res;
+  thread runner([&ctx, &res]{ res = ctx.run(); });
+  this_thread::sleep_for(chrono::milliseconds(20));
+  ctx.cancel();
+  runner.join();
+  EXPECT_TRUE(res == "Error: cancelled");
+  EXPECT_TRUE(ctx.runStatus() == Interpreter::RunStatus::CANCELLED);
+}
+TEST_F(InprTest, profilerTest){
+  string script = "function inc{ $0 + 1; }; $a = 0; while ($a < 5) { $a = inc($a); }; $a";
+  EXPECT_TRUE(ir.cmd(script) == "5");
+  EXPECT_TRUE(ir.profile().empty());
+
+  for (bool bytecode : {true, false}) {
+    ir.useBytecode(bytecode);
+    ir.useProfiler(true);
+    EXPECT_TRUE(ir.cmd(script) == "5");
+    EXPECT_TRUE(ir.cmd(script) == "5");
+
+    map<string, size_t> hits;
+    for (auto& p : ir.profile())
+      hits[p.entity.type == Interpreter::EntityType::WHILE ? "while" : p.entity.name] += p.hits;
+    EXPECT_TRUE(hits["while"] == 2);
+    EXPECT_TRUE(hits["inc"] == 10);
+    EXPECT_TRUE(hits["<"] == 12);
+
+    string folded = ir.profileFolded();
+    EXPECT_TRUE(folded.find("script;while@") != string::npos);
+    EXPECT_TRUE(folded.find(";inc@") != string::npos);
+    EXPECT_TRUE(folded.find(";+@") != string::npos);
+
+    EXPECT_TRUE(ir.cmd("$b = 1 + 2; $b") == "3");  // another script resets statistics
+    EXPECT_TRUE(ir.profile().size() == 2);
+    ir.useProfiler(false);
+  }
+  ir.useBytecode(true);
+}
+TEST_F(InprTest, functionViewTest){
+  ir.addFunctionView("summV", [](Interpreter::ArgsView args, string& outResult) {
+    int res = 0;
+    for (string_view v : args) {
+      if (isNumber(string(v))) res += stoi(string(v));
+    }
+    outResult = to_string(res);
+  });
+  ir.addFunctionView("concat", [](Interpreter::ArgsView args, string& outResult) {
+    EXPECT_TRUE(outResult.empty());
+    for (string_view v : args)
+      outResult += v;
+  }, true);
+
+  for (bool bytecode : {true, false}) {
+    ir.useBytecode(bytecode);
+    EXPECT_TRUE(ir.cmd("$c = 5; $d = $c + 5; summV($c, $d, summV(6 + 5, 3))") == "29");
+    EXPECT_TRUE(ir.cmd("summV(summV(1, summV(2, summ(3, 4))), summV())") == "10");
+    EXPECT_TRUE(ir.cmd("$a = \"abc\"; concat($a, \"def\", 12)") == "abcdef12");
+    EXPECT_TRUE(ir.cmd("function myFunc{ summV($0, $1) * 2; }; myFunc(2, summV(1, 2))") == "10");
+  }
+  ir.useBytecode(true);
+
+  EXPECT_TRUE(ir.runFunction("summV", {"1", "2", "3"}) == "6");
+  EXPECT_TRUE(ir.getUserFunction("concat")({"a", "b"}) == "ab");
+
+  ir.useOptimization(true);
+  EXPECT_TRUE(ir.cmd("$e = concat(1 + 2, \"x\"); $e") == "3x");
+  EXPECT_TRUE(ir.allEntities().size() == 6);  // as "$e = 3x; $e"
+  ir.useOptimization(false);
+
+  ir.addFunction("summV", [](const vector<string>& args) ->string {
+    return "old";
+  });
+  EXPECT_TRUE(ir.cmd("summV(1, 2)") == "old");
+}
+TEST_F(InprTest, evalScriptTest){
+  string res, err;
+  ir.cmd("$a = 5; $b = 2;");
+  EXPECT_TRUE(ir.evalScript("$a + $b", res, err) && (res == "7"));
+  EXPECT_TRUE(ir.evalScript("$a = 10; $a", res, err) && (res == "10"));
+  EXPECT_TRUE(ir.variable("$a") == "5");
+  EXPECT_TRUE(!ir.evalScript("while (0) {}", res, err) && !err.empty());
+
+  ir.cmd("$z = 3;");  // new variable
+  EXPECT_TRUE(ir.evalScript("$z + $a", res, err) && (res == "8"));
+  ir.addFunction("twice", [](const vector<string>& args) ->string {
+    return args.empty() ? "" : args[0] + args[0];
+  });
+  EXPECT_TRUE(ir.evalScript("twice($z)", res, err) && (res == "33"));
+
+  Interpreter* pIr = &ir;
+  ir.addFunction("eval", [pIr](const vector<string>& args) ->string {
+    string res, err;
+    return !args.empty() && pIr->evalScript(args[0], res, err) ? res : err;
+  });
+  EXPECT_TRUE(ir.cmd("$a = 2; $e = \"$a + 1\"; eval(\"$a * eval($e)\")") == "6");
+  EXPECT_TRUE(ir.cmd("a = Vector{1, 2, $a + 1}; $s = 0; $i = 0; while ($i < 3) { $s += a[$i]; $i += 1; }; $s") == "6");
+}
+TEST_F(InprTest, iterableTest){
+  ir.addIterable([](const string& container) ->Interpreter::UserIterator {
+    if (container != "three")
+      return nullptr;
+    return [n = 0](string& outValue) mutable {
+      if (n == 3) return false;
+      outValue = to_string(++n);
+      return true;
+    };
+  });
+  for (bool bytecode : {true, false}) {
+    ir.useBytecode(bytecode);
+    EXPECT_TRUE(ir.cmd("$s = 0; while ($v : three) { $s += $v; }; $s") == "6");
+    EXPECT_TRUE(ir.cmd("a = Vector{1, 2, 3}; $s = 0; while ($v : a) { if ($v == 3) break; $s += $v; }; $s") == "3");
+    EXPECT_TRUE(ir.cmd("a = Vector{1, 2}; $s = 0; while ($x : a) { while ($y : a) { $s += $x * $y; }; }; $s") == "9");
+    EXPECT_TRUE(ir.cmd("a = Vector{1}; $n = 0; while ($v : a) { if ($v < 3) a.push_back($v + 1); $n += 1; }; $n") == "3");
+    EXPECT_TRUE(ir.cmd("b = Map{one : 1, two : 2}; $r = 0; while ($v : b) { $r = $v; }; $r") == "two\t2");
+    EXPECT_TRUE(ir.cmd("b = Map{one : 1, three : 3, two : 2}; $n = 0; while ($v : b) { b.erase(two); $n += 1; }; $n") == "2");
+  }
+  ir.useBytecode(true);
+}
+TEST_F(InprTest, fileTest){
+  InterpreterBaseLib::Filesystem fs_ir(ir);
+  ir.cmd("$nl = 0;");
+  ir.setVariable("$nl", "\n");
+  for (bool bytecode : {true, false}) {
+    ir.useBytecode(bytecode);
+    EXPECT_TRUE(ir.cmd("f = File{\"test_file.txt\"}; f.write(1); $i = 2; while ($i < 5) { f.append($nl + $i); $i += 1; }; f.read()") == "1\n2\n3\n4");
+    EXPECT_TRUE(ir.cmd("$s = 0; $n = 0; while ($line : f.lines()) { $s += $line; $n += 1; }; $n * 100 + $s") == "410");
+    EXPECT_TRUE(ir.cmd("$n = 0; $c = 0; while ($v : f.chunks(3)) { $n += 1; $c = $v; }; $n") == "3");
+    EXPECT_TRUE(ir.variable("$c") == "4");
+    EXPECT_TRUE(ir.cmd("f.append(5); g = File{\"test_file.txt\"}; g.read()") == "1\n2\n3\n45");
+    EXPECT_TRUE(ir.cmd("f.close(); f.remove(); f.exist()") == "0");
+    EXPECT_TRUE(ir.cmd("f.read()") == "0");
+  }
+  ir.useBytecode(true);
+}
+TEST_F(InprTest, operandMutabilityTest){
+  const char* lData = nullptr;
+  ir.addOperator("<-", [&lData](string& leftOpd, string& rightOpd) ->string {
+    lData = leftOpd.data();
+    rightOpd = "taken";
+    return leftOpd;
+  }, 5, false, Interpreter::OperandMutability::RIGHT);
+  for (bool bytecode : {true, false}) {
+    ir.useBytecode(bytecode);
+    EXPECT_TRUE(ir.cmd("$a = 1; $b = 2; $c = $a <- $b; $c") == "1");
+    EXPECT_TRUE((ir.variable("$a") == "1") && (ir.variable("$b") == "taken"));
+    EXPECT_TRUE(ir.cmd("$a = abc; $a += $a; $a") == "abcabc");
+    EXPECT_TRUE(ir.cmd("$a = 3; $b = $a + ($a = 5); $b") == "8");
+    EXPECT_TRUE(ir.cmd("$a = 3; $a += summ($a, 1); $a") == "7");
+    EXPECT_TRUE(ir.cmd("$a = 1; ++$a; $a") == "2");
+  }
+  ir.useBytecode(true);
+
+  // the operator view gets the variable by its own string
+  ir.addOperatorView("<~", [&lData](const string& leftOpd, const string&) ->string {
+    lData = leftOpd.data();
+    return leftOpd;
+  }, 5);
+  string buff(1000, 'a'), err;
+  ir.setVariable("$buff", buff);
+  EXPECT_TRUE(ir.parseScript("$buff <~ $b;", err));
+  ir.runScript();
+  const char* firstData = lData;
+  ir.runScript();
+  EXPECT_TRUE(lData == firstData);
+  EXPECT_TRUE(ir.variable("$buff") == buff);
+
+  // the read only operand is a copy
+  ir.addOperator("~>", [](string& leftOpd, string& rightOpd) ->string {
+    rightOpd = "changed";
+    return leftOpd;
+  }, 5, false, Interpreter::OperandMutability::LEFT);
+  EXPECT_TRUE(ir.cmd("$a = 1; $b = 2; $a ~> $b; $b") == "2");
+
+  // the operator adds variables while the operands are bound
+  size_t added = 0;
+  ir.addOperator("+=", [this, &added](string& leftOpd, string& rightOpd) ->string {
+    for (int i = 0; i < 100; ++i)
+      ir.setVariable("$added" + to_string(added++), "1");
+    leftOpd += rightOpd;
+    return leftOpd;
+  }, 4, false, Interpreter::OperandMutability::LEFT);
+  for (bool bytecode : {true, false}) {
+    ir.useBytecode(bytecode);
+    EXPECT_TRUE(ir.cmd("$a = 1; $b = x; $a += $b; $a") == "1x");
+    EXPECT_TRUE(ir.variable("$b") == "x");
+  }
+}
+TEST(CApiTest, bufferTest){
+  HIntr h = irCreateIntr();
+  int calls = 0;
+  EXPECT_TRUE(irAddOperatorView(h, "+", [](irStr* ioLeft, irStr* ioRight, void*) ->irStr {
+    static thread_local string res;
+    res = to_string(stoi(string(ioLeft->data, ioLeft->size)) + stoi(string(ioRight->data, ioRight->size)));
+    return irStr{ res.data(), res.size() };
+  }, 1, nullptr));
+  EXPECT_TRUE(irAddOperatorView(h, "=", [](irStr* ioLeft, irStr* ioRight, void*) ->irStr {
+    *ioLeft = *ioRight;
+    return *ioRight;
+  }, 17, nullptr));
+  EXPECT_TRUE(irAddFunctionView(h, "count", [](const irStr* args, size_t count, void* userData) ->irStr {
+    ++*static_cast<int*>(userData);
+    return count > 0 ? args[count - 1] : irStr{ nullptr, 0 };
+  }, &calls));
+
+  size_t sz = 0;
+  EXPECT_TRUE(string(irCmdRef(h, "$a = 12 + 30; $a", &sz)) == "42" && (sz == 2));
+  EXPECT_TRUE(string(irCmdRef(h, "count(1, 2, 3, 4, 5, 6, 7, 8, 9, long)", &sz)) == "long" && (calls == 1));
+
+  char buff[4];
+  EXPECT_TRUE(irCmdBuff(h, "$b = 1000 + 2345; $b", buff, sizeof(buff)) == 4);
+  EXPECT_TRUE(string(buff) == "334");
+  char whole[16];
+  EXPECT_TRUE((irLastResult(h, whole, sizeof(whole)) == 4) && (string(whole) == "3345"));
+  EXPECT_TRUE((irVariableBuff(h, "$a", buff, sizeof(buff)) == 2) && (string(buff) == "42"));
+  EXPECT_TRUE(string(irVariableRef(h, "$b", nullptr)) == "3345");
+  EXPECT_TRUE((irRunScriptBuff(h, whole, sizeof(whole)) == 4) && (string(whole) == "3345"));
+  irDeleteIntr(h);
+}
 
 int main(int argc, char* argv[]){
  